@@ -0,0 +1,238 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <boost/asio.hpp>
+#include "ws.hpp"
+
+/* Accept rate during a connection storm: a child process connects to the
+ * server over loopback from clients threads, closing each connection
+ * straight away, until connections have been made, while the server
+ * accepts them on one io thread:
+ *
+ *     accept_storm [connections] [clients] [workers]
+ *
+ * Measured for a plain async_accept() loop, then for ws::acceptor with a
+ * batch size of 1 and of 64, and then with a batch size of 64 handing
+ * connections to workers io_services (default 2) on their own threads, which
+ * should each get an equal share. */
+
+using boost::asio::ip::tcp;
+typedef std::chrono::steady_clock clock_type;
+
+/* Connects until count connections have been made, then exits */
+void storm(unsigned short port, std::size_t count, std::size_t clients) {
+    tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), port);
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < clients; ++i) {
+        std::size_t share = count / clients + (i < count % clients ? 1 : 0);
+        threads.emplace_back([endpoint, share]() {
+            boost::asio::io_service io_service;
+            for (std::size_t n = 0; n < share; ++n) {
+                tcp::socket socket(io_service);
+                boost::system::error_code ec;
+                socket.connect(endpoint, ec);
+            }
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+}
+
+/* Counts accepted connections, stopping the io_service at the last */
+class counter {
+public:
+    counter(boost::asio::io_service &io_service, std::size_t count) :
+        io_service_(io_service), count_(count), accepted_(0) { }
+
+    void operator()() {
+        if (accepted_++ == 0)
+            start_ = clock_type::now();
+        if (accepted_ == count_) {
+            end_ = clock_type::now();
+            io_service_.stop();
+        }
+    }
+
+    double rate() const {
+        return (count_ - 1) / std::chrono::duration<double>(
+            end_ - start_).count();
+    }
+
+private:
+    boost::asio::io_service &io_service_;
+    std::size_t count_;
+    std::size_t accepted_;
+    clock_type::time_point start_;
+    clock_type::time_point end_;
+};
+
+/* Counts connections per worker, stopping the acceptor's io_service at the
+ * last */
+class worker_counter {
+public:
+    worker_counter(boost::asio::io_service &io_service,
+        const std::vector<boost::asio::io_service *> &workers,
+        std::size_t count) :
+        io_service_(io_service), workers_(workers), count_(count),
+        accepted_(0), per_worker_(workers.size())
+    {
+        for (auto &n : per_worker_)
+            n = 0;
+    }
+
+    /* Called on the worker's thread */
+    void operator()(boost::asio::ip::tcp::socket &socket) {
+        for (std::size_t i = 0; i < workers_.size(); ++i)
+            if (&socket.get_executor().context() == workers_[i])
+                ++per_worker_[i];
+
+        std::size_t n = ++accepted_;
+        if (n == 1)
+            start_ = clock_type::now();
+        if (n == count_) {
+            end_ = clock_type::now();
+            io_service_.stop();
+        }
+    }
+
+    double rate() const {
+        return (count_ - 1) / std::chrono::duration<double>(
+            end_ - start_).count();
+    }
+
+    std::string shares() const {
+        std::string s;
+        for (auto &n : per_worker_)
+            s += (s.empty() ? "" : " ") + std::to_string(n);
+        return s;
+    }
+
+private:
+    boost::asio::io_service &io_service_;
+    std::vector<boost::asio::io_service *> workers_;
+    std::size_t count_;
+    std::atomic<std::size_t> accepted_;
+    std::vector<std::atomic<std::size_t>> per_worker_;
+    clock_type::time_point start_;
+    clock_type::time_point end_;
+};
+
+void async_accept_loop(tcp::acceptor &acceptor, tcp::socket &socket,
+    counter &c)
+{
+    acceptor.async_accept(socket,
+        [&acceptor, &socket, &c](const boost::system::error_code &ec)
+    {
+        if (!ec) {
+            socket.close();
+            c();
+        }
+        async_accept_loop(acceptor, socket, c);
+    });
+}
+
+void report(const std::string &name, pid_t child, const counter &c) {
+    ::waitpid(child, nullptr, 0);
+    std::cout << name << ": " << static_cast<std::size_t>(c.rate())
+        << " connections/s\n";
+}
+
+int main(int argc, const char **argv) {
+    std::size_t connections = argc > 1 ?
+        std::strtoul(argv[1], nullptr, 10) : 20000;
+    std::size_t clients = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 8;
+    std::size_t workers = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 2;
+    if (connections < 2 || !clients || !workers) {
+        std::cerr << "connections must be at least 2, clients and workers "
+            "positive\n";
+        return EXIT_FAILURE;
+    }
+
+    try {
+        {
+            boost::asio::io_service io_service;
+            tcp::acceptor acceptor(io_service, tcp::endpoint(
+                boost::asio::ip::address_v4::loopback(), 0));
+            acceptor.listen(boost::asio::socket_base::max_listen_connections);
+            tcp::socket socket(io_service);
+            counter c(io_service, connections);
+            async_accept_loop(acceptor, socket, c);
+
+            pid_t child = ::fork();
+            if (child == 0) {
+                storm(acceptor.local_endpoint().port(), connections, clients);
+                ::_exit(EXIT_SUCCESS);
+            }
+            io_service.run();
+            report("async_accept", child, c);
+        }
+
+        for (std::size_t batch : { 1, 64 }) {
+            boost::asio::io_service io_service;
+            counter c(io_service, connections);
+            ws::acceptor_options options;
+            options.batch_size = batch;
+            ws::acceptor acceptor(io_service, tcp::endpoint(
+                boost::asio::ip::address_v4::loopback(), 0),
+                [&c](tcp::socket) { c(); }, options);
+
+            pid_t child = ::fork();
+            if (child == 0) {
+                storm(acceptor.local_endpoint().port(), connections, clients);
+                ::_exit(EXIT_SUCCESS);
+            }
+            io_service.run();
+            report("ws::acceptor, batch " + std::to_string(batch), child, c);
+        }
+
+        {
+            std::vector<std::unique_ptr<boost::asio::io_service>> pool;
+            std::vector<std::unique_ptr<boost::asio::io_service::work>> work;
+            std::vector<std::thread> threads;
+            ws::acceptor_options options;
+            for (std::size_t i = 0; i < workers; ++i) {
+                pool.emplace_back(new boost::asio::io_service);
+                work.emplace_back(
+                    new boost::asio::io_service::work(*pool.back()));
+                options.workers.push_back(pool.back().get());
+            }
+
+            boost::asio::io_service io_service;
+            worker_counter c(io_service, options.workers, connections);
+            ws::acceptor acceptor(io_service, tcp::endpoint(
+                boost::asio::ip::address_v4::loopback(), 0),
+                [&c](tcp::socket socket) { c(socket); }, options);
+            for (auto &w : pool) {
+                boost::asio::io_service *p = w.get();
+                threads.emplace_back([p]() { p->run(); });
+            }
+
+            pid_t child = ::fork();
+            if (child == 0) {
+                storm(acceptor.local_endpoint().port(), connections, clients);
+                ::_exit(EXIT_SUCCESS);
+            }
+            io_service.run();
+            ::waitpid(child, nullptr, 0);
+
+            work.clear();
+            for (auto &t : threads)
+                t.join();
+            std::cout << "ws::acceptor, batch 64, " << workers
+                << " workers: " << static_cast<std::size_t>(c.rate())
+                << " connections/s, per worker " << c.shares() << "\n";
+        }
+    } catch (std::exception &e) {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
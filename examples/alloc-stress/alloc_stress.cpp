@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ws/message.hpp"
+
+/* Heap allocations made for received payloads: each thread keeps a window
+ * of live payloads, the way queued messages are, and replaces the oldest
+ * with a new one of the next size, once as a std::vector (what a message
+ * used to hold) and once as a ws::payload:
+ *
+ *     alloc_stress [frames] [threads] [window]
+ *
+ * Reports heap allocations (operator new calls, the window itself included)
+ * per million frames and the time per frame, for fixed payload sizes and
+ * for a mix of sizes. */
+
+static std::atomic<std::size_t> allocations(0);
+
+void *operator new(std::size_t size) {
+    ++allocations;
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) {
+    ++allocations;
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+/* Out of line, or gcc pairs the inlined free() with new expressions and
+ * warns about a mismatch */
+__attribute__((noinline))
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline))
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline))
+void operator delete[](void *p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline))
+void operator delete[](void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+typedef std::chrono::steady_clock clock_type;
+
+/* Sizes for the mixed run: mostly small messages, some medium, a few up to
+ * 64 KiB, from a fixed sequence so every run sees the same ones */
+std::vector<std::size_t> mixed_sizes(std::size_t count) {
+    std::vector<std::size_t> sizes;
+    sizes.reserve(count);
+    std::uint32_t x = 2463534242u;
+    for (std::size_t i = 0; i < count; ++i) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        std::size_t bucket = x % 100;
+        if (bucket < 70)
+            sizes.push_back(1 + x % 64);
+        else if (bucket < 95)
+            sizes.push_back(65 + x % 4032);
+        else
+            sizes.push_back(4097 + x % 61440);
+    }
+    return sizes;
+}
+
+template <typename Payload>
+void churn(const std::vector<std::size_t> &sizes, std::size_t frames,
+    std::size_t window)
+{
+    std::vector<Payload> live(window);
+    for (std::size_t i = 0; i < frames; ++i) {
+        Payload p(sizes[i % sizes.size()]);
+        /* Touch it, as unmasking the frame would */
+        if (!p.empty())
+            std::memset(p.data(), static_cast<int>(i), p.size());
+        live[i % window] = std::move(p);
+    }
+}
+
+template <typename Payload>
+void run(const std::string &name, const std::string &label,
+    const std::vector<std::size_t> &sizes, std::size_t frames,
+    std::size_t threads, std::size_t window)
+{
+    /* Each thread warms up first, so that the steady state a long-lived io
+     * thread would see is what gets measured */
+    std::atomic<std::size_t> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<clock_type::time_point> ends(threads);
+    std::vector<std::thread> workers;
+    for (std::size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            churn<Payload>(sizes, window * 4, window);
+            ++ready;
+            while (!go)
+                std::this_thread::yield();
+            churn<Payload>(sizes, frames, window);
+            ends[t] = clock_type::now();
+        });
+    }
+    while (ready != threads)
+        std::this_thread::yield();
+
+    std::size_t before = allocations;
+    auto start = clock_type::now();
+    go = true;
+    for (auto &w : workers)
+        w.join();
+
+    std::size_t made = allocations - before;
+    double ns = 0;
+    for (auto &end : ends)
+        ns = std::max(ns, std::chrono::duration<double, std::nano>(
+            end - start).count());
+
+    std::cout << std::left << std::setw(12) << label << std::setw(12)
+        << name << std::right << std::setw(14)
+        << static_cast<double>(made) * 1000000 / (frames * threads)
+        << std::setw(12) << ns / frames << "\n";
+}
+
+int main(int argc, const char **argv) {
+    std::size_t frames = argc > 1 ? std::strtoul(argv[1], nullptr, 10) :
+        1000000;
+    std::size_t threads = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1;
+    std::size_t window = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 16;
+    if (!frames || !threads || !window) {
+        std::cerr << "frames, threads and window must be positive\n";
+        return EXIT_FAILURE;
+    }
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << std::left << std::setw(12) << "size" << std::setw(12)
+        << "storage" << std::right << std::setw(14) << "allocs/Mframe"
+        << std::setw(12) << "ns/frame" << "\n";
+
+    const std::size_t fixed[] = { 8, 64, 200, 1500, 16384, 65536 };
+    for (std::size_t size : fixed) {
+        std::vector<std::size_t> sizes(1, size);
+        std::string label = std::to_string(size);
+        run<std::vector<unsigned char>>("vector", label, sizes, frames,
+            threads, window);
+        run<ws::payload>("ws::payload", label, sizes, frames, threads,
+            window);
+    }
+
+    std::vector<std::size_t> sizes = mixed_sizes(4096);
+    run<std::vector<unsigned char>>("vector", "mixed", sizes, frames,
+        threads, window);
+    run<ws::payload>("ws::payload", "mixed", sizes, frames, threads, window);
+
+    return EXIT_SUCCESS;
+}
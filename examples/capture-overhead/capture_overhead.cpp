@@ -0,0 +1,78 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ws/capture.hpp"
+
+/* Cost of recording a frame with ws::capture: record() is called records
+ * times for a payload of size bytes, storing payloads and then only their
+ * hashes, first to one capture and then alternating between two as sessions
+ * of different captures sharing an io thread would:
+ *
+ *     capture_overhead [records] [size]
+ *
+ * The rings are made large enough to hold every record, so none are dropped
+ * and the figure is the cost of copying into the ring. Capture files are
+ * written to the current directory and removed afterwards. */
+
+typedef std::chrono::steady_clock clock_type;
+
+void run(const std::string &name, ws::capture_mode mode,
+    std::size_t captures, std::size_t records, std::size_t size)
+{
+    /* Header, payload and padding of every record, plus some slack */
+    std::size_t ring_size = records / captures * (size + 48) + (1 << 20);
+    std::vector<std::string> paths;
+    std::vector<std::unique_ptr<ws::capture>> c;
+    for (std::size_t i = 0; i < captures; ++i) {
+        paths.push_back("capture_overhead." + std::to_string(i) + ".wscap");
+        c.emplace_back(new ws::capture(paths.back(), mode, ring_size));
+    }
+
+    std::vector<unsigned char> payload(size, 'x');
+    auto start = clock_type::now();
+    for (std::size_t i = 0; i < records; ++i)
+        c[i % captures]->record(i, ws::message::opcode::binary,
+            payload.data(), payload.size());
+    double ns = std::chrono::duration<double, std::nano>(
+        clock_type::now() - start).count();
+
+    std::uint64_t dropped = 0;
+    for (auto &capture : c)
+        dropped += capture->dropped();
+    c.clear();
+    for (auto &path : paths)
+        std::remove(path.c_str());
+
+    std::cout << name << ": " << ns / records << " ns/record, " << dropped
+        << " dropped\n";
+}
+
+int main(int argc, const char **argv) {
+    std::size_t records = argc > 1 ? std::strtoul(argv[1], nullptr, 10) :
+        1000000;
+    std::size_t size = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 128;
+    if (!records) {
+        std::cerr << "records must be positive\n";
+        return EXIT_FAILURE;
+    }
+
+    try {
+        run("payloads, one capture", ws::capture_mode::payloads, 1, records,
+            size);
+        run("hashes, one capture", ws::capture_mode::hashes, 1, records,
+            size);
+        run("payloads, two captures", ws::capture_mode::payloads, 2,
+            records, size);
+        run("hashes, two captures", ws::capture_mode::hashes, 2, records,
+            size);
+    } catch (std::exception &e) {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -10,19 +10,25 @@
 //
 
 #include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <cstdlib>
 #include <deque>
 #include <iostream>
+#include <memory>
 #include <set>
+#include <string>
+#include <vector>
 #include <boost/asio.hpp>
 #include "ws.hpp"
+#include "ws/restart.hpp"
 #include "chat_message.hpp"
 
 using boost::asio::ip::tcp;
 
 //----------------------------------------------------------------------
 
-typedef std::deque<chat_message> chat_message_queue;
+typedef std::deque<ws::frame_ptr> chat_frame_queue;
 
 //----------------------------------------------------------------------
 
@@ -30,7 +36,8 @@ class chat_participant {
 public:
     chat_participant(tcp::socket socket) : socket_(std::move(socket)) { }
     virtual ~chat_participant() {}
-    virtual void deliver(const chat_message& msg) = 0;
+    virtual void deliver(const ws::frame_ptr& frame) = 0;
+    virtual void deliver(const std::vector<ws::frame_ptr>& frames) = 0;
 protected:
     tcp::socket socket_;
 };
@@ -43,11 +50,19 @@ typedef chat_participant * chat_participant_ptr;
 class chat_room
 {
 public:
-  void join(chat_participant_ptr participant)
+  chat_room()
+    : recent_msgs_(max_recent_msgs)
+  {
+  }
+
+  // Sends the backlog newer than `since` as a single batch; pass the last
+  // sequence number a reconnecting participant saw to resume from there.
+  void join(chat_participant_ptr participant, std::uint64_t since = 0)
   {
     participants_.insert(participant);
-    for (auto msg: recent_msgs_)
-      participant->deliver(msg);
+    std::vector<ws::frame_ptr> backlog = recent_msgs_.since(since);
+    if (!backlog.empty())
+      participant->deliver(backlog);
   }
 
   void leave(chat_participant_ptr participant)
@@ -57,18 +72,19 @@ public:
 
   void deliver(const chat_message& msg)
   {
-    recent_msgs_.push_back(msg);
-    while (recent_msgs_.size() > max_recent_msgs)
-      recent_msgs_.pop_front();
+    // Encode once, every participant shares the same frame
+    ws::frame_ptr frame = ws::make_frame(ws::message::opcode::text,
+      boost::asio::buffer(msg.data(), msg.length()));
+    recent_msgs_.push(frame);
 
     for (auto participant: participants_)
-      participant->deliver(msg);
+      participant->deliver(frame);
   }
 
 private:
   std::set<chat_participant_ptr> participants_;
   enum { max_recent_msgs = 100 };
-  chat_message_queue recent_msgs_;
+  ws::history recent_msgs_;
 };
 
 //----------------------------------------------------------------------
@@ -103,7 +119,7 @@ private:
         if (msg.get_opcode() != ws::message::opcode::text)
             return;
 
-        const std::vector<unsigned char> &payload = msg.get_payload();
+        const ws::payload &payload = msg.get_payload();
 
         if (payload.size() < 4 || payload.size() > chat_message::header_length +
             chat_message::max_body_length)
@@ -132,20 +148,30 @@ private:
         std::cout << "on_error\n";
     }
 
-    void deliver(const chat_message& msg) override {
+    void deliver(const ws::frame_ptr& frame) override {
+        bool write_in_progress = !write_msgs_.empty();
+        write_msgs_.push_back(frame);
+        if (!write_in_progress) {
+            do_write();
+        }
+    }
+
+    void deliver(const std::vector<ws::frame_ptr>& frames) override {
         bool write_in_progress = !write_msgs_.empty();
-        write_msgs_.push_back(msg);
+        write_msgs_.insert(write_msgs_.end(), frames.begin(), frames.end());
         if (!write_in_progress) {
             do_write();
         }
     }
 
+    /* Everything queued so far goes out in one gathered write */
     void do_write() {
-        write(ws::message::opcode::text,
-            boost::asio::buffer(write_msgs_.front().data(),
-            write_msgs_.front().length()), [this]()
-        {
-            write_msgs_.pop_front();
+        std::vector<ws::frame_ptr> frames(write_msgs_.begin(),
+            write_msgs_.end());
+        std::size_t count = frames.size();
+        write(frames, [this, count]() {
+            write_msgs_.erase(write_msgs_.begin(),
+                write_msgs_.begin() + count);
             if (!write_msgs_.empty())
                 do_write();
         });
@@ -153,48 +179,80 @@ private:
 
     chat_room& room_;
     chat_message read_msg_;
-    chat_message_queue write_msgs_;
+    chat_frame_queue write_msgs_;
 };
 
 //----------------------------------------------------------------------
 
 class chat_server {
 public:
+    /* listener_fd is a listening socket inherited from a previous process, or
+     * -1 to bind endpoint */
     chat_server(boost::asio::io_service& io_service,
-        const tcp::endpoint& endpoint) :
-        acceptor_(io_service, endpoint), socket_(io_service)
+        const tcp::endpoint& endpoint, const std::string& handoff_path,
+        int listener_fd) :
+        drainer_(io_service, drain_rate, std::chrono::seconds(5))
     {
-        do_accept();
+        auto on_accept = [this](tcp::socket socket) {
+            auto session = std::make_shared<chat_session>(
+                std::move(socket), room_);
+            track(session);
+            session->start();
+        };
+
+        if (listener_fd >= 0) {
+            acceptor_.reset(new ws::acceptor(io_service, endpoint.protocol(),
+                listener_fd, on_accept));
+        } else {
+            acceptor_.reset(new ws::acceptor(io_service, endpoint,
+                on_accept));
+        }
+
+        handoff_.reset(new ws::handoff_server(io_service, handoff_path,
+            acceptor_->native_handle(), [this]() { drain(); }));
     }
 
 private:
-    void do_accept() {
-        acceptor_.async_accept(socket_,
-            [this](boost::system::error_code ec)
-        {
-            if (!ec) {
-                std::make_shared<chat_session>(
-                    std::move(socket_), room_)->start();
-            }
+    enum { drain_rate = 1000 };
+
+    void track(const std::shared_ptr<chat_session>& session) {
+        if (sessions_.size() == sessions_.capacity()) {
+            sessions_.erase(std::remove_if(sessions_.begin(), sessions_.end(),
+                [](const std::weak_ptr<chat_session>& s) {
+                    return s.expired();
+                }), sessions_.end());
+        }
+        sessions_.push_back(session);
+    }
 
-            do_accept();
-        });
+    /* A new process has taken over the listening socket */
+    void drain() {
+        std::cout << "handing over, draining " << sessions_.size()
+            << " sessions\n";
+        acceptor_->close();
+        drainer_.drain(std::move(sessions_), nullptr);
     }
 
-    tcp::acceptor acceptor_;
-    tcp::socket socket_;
     chat_room room_;
+    std::unique_ptr<ws::acceptor> acceptor_;
+    std::unique_ptr<ws::handoff_server> handoff_;
+    std::vector<std::weak_ptr<chat_session>> sessions_;
+    ws::drainer<chat_session> drainer_;
 };
 
 //----------------------------------------------------------------------
 
 int main(int, const char **) {
     const unsigned short PORT = 4567;
+    const std::string HANDOFF_PATH = "chat_server.sock";
 
     try {
         boost::asio::io_service io_service;
         tcp::endpoint endpoint(tcp::v4(), PORT);
-        chat_server server(io_service, endpoint);
+
+        /* Take over from a running chat_server if there is one */
+        int listener_fd = ws::acquire_listener(HANDOFF_PATH);
+        chat_server server(io_service, endpoint, HANDOFF_PATH, listener_fd);
         io_service.run();
     } catch (std::exception& e) {
         std::cerr << "Exception: " << e.what() << "\n";
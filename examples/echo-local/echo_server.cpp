@@ -0,0 +1,91 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <boost/asio.hpp>
+#include "ws.hpp"
+
+/* Echo server on both a Unix domain socket and TCP, with the same session
+ * code for each. Nothing is printed per message, so it can be used to
+ * compare the two transports (see examples/pingpong). */
+
+using boost::asio::ip::tcp;
+using boost::asio::local::stream_protocol;
+
+template <typename Socket>
+class session_base {
+public:
+    session_base(Socket socket) : socket_(std::move(socket)) { }
+protected:
+    Socket socket_;
+};
+
+template <typename Socket>
+class session : public session_base<Socket>, public ws::session<Socket> {
+public:
+    session(Socket socket) :
+        session_base<Socket>(std::move(socket)),
+        ws::session<Socket>(this->socket_) { }
+
+private:
+    void on_open() override {
+        std::cout << "WebSocket connection open\n";
+    }
+
+    void on_msg(const ws::message &msg) override {
+        const ws::payload &payload = msg.get_payload();
+
+        this->write(msg.get_opcode(),
+            boost::asio::buffer(payload.data(), payload.size()), [this]()
+        {
+            this->read();
+        });
+    }
+
+    void on_close() override {
+        std::cout << "WebSocket connection closed\n";
+    }
+
+    void on_error() override {
+        std::cout << "WebSocket connection error\n";
+    }
+};
+
+class server {
+public:
+    server(boost::asio::io_service& io_service,
+        const stream_protocol::endpoint& local_endpoint,
+        const tcp::endpoint& tcp_endpoint) :
+        local_acceptor_(io_service, local_endpoint,
+            [](stream_protocol::socket socket) {
+                std::make_shared<session<stream_protocol::socket>>(
+                    std::move(socket))->start();
+            }),
+        tcp_acceptor_(io_service, tcp_endpoint, [](tcp::socket socket) {
+            std::make_shared<session<tcp::socket>>(std::move(socket))->start();
+        }) { }
+
+private:
+    ws::local_acceptor local_acceptor_;
+    ws::acceptor tcp_acceptor_;
+};
+
+int main(int, const char **) {
+    const std::string PATH = "echo_server.sock";
+    const unsigned short PORT = 4567;
+
+    try {
+        boost::asio::io_service io_service;
+
+        /* A socket file left by an earlier run would make bind() fail */
+        ::unlink(PATH.c_str());
+
+        server server(io_service, stream_protocol::endpoint(PATH),
+            tcp::endpoint(tcp::v4(), PORT));
+        io_service.run();
+    } catch (std::exception& e) {
+        std::cerr << "Exception: " << e.what() << "\n";
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -4,6 +4,7 @@
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 #include "ws.hpp"
+#include "ws/tls.hpp"
 
 using boost::asio::ip::tcp;
 
@@ -48,7 +49,7 @@ private:
     }
 
     void on_msg(const ws::message &msg) override {
-        const std::vector<unsigned char> payload = msg.get_payload();
+        const ws::payload &payload = msg.get_payload();
 
         std::cout << "WebSocket message received: ";
         if (msg.get_opcode() == ws::message::opcode::text) {
@@ -93,6 +94,7 @@ public:
         context_.use_private_key_file("echo-secure.key",
             boost::asio::ssl::context::pem);
         context_.use_certificate_chain_file("echo-secure.crt");
+        ws::tls::configure_server(context_);
 
         accept();
     }
@@ -1,8 +1,10 @@
 #include <cstdlib>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <boost/asio.hpp>
 #include "ws.hpp"
+#include "ws/capture.hpp"
 
 using boost::asio::ip::tcp;
 
@@ -16,10 +18,13 @@ protected:
 using T = tcp::socket;
 class session : public session_base, public ws::session<T> {
 public:
-    session(tcp::socket socket) :
-        session_base(std::move(socket)), ws::session<T>(socket_)
+    session(tcp::socket socket, ws::capture *capture,
+        ws::handshake_limiter &limiter) :
+        session_base(std::move(socket)), ws::session<T>(socket_),
+        capture_(capture)
     {
         std::cout << "session()\n";
+        set_handshake_limiter(limiter);
     }
 
     ~session() {
@@ -27,12 +32,17 @@ public:
     }
 
 private:
+    ws::capture *capture_;
+
     void on_open() override {
         std::cout << "WebSocket connection open\n";
+        set_release_idle_buffer(true);
+        if (capture_)
+            set_capture(*capture_);
     }
 
     void on_msg(const ws::message &msg) override {
-        const std::vector<unsigned char> payload = msg.get_payload();
+        const ws::payload &payload = msg.get_payload();
 
         std::cout << "WebSocket message received: ";
         if (msg.get_opcode() == ws::message::opcode::text) {
@@ -66,36 +76,43 @@ private:
 class server {
 public:
     server(boost::asio::io_service& io_service,
-        const tcp::endpoint& endpoint) :
-        acceptor_(io_service, endpoint), socket_(io_service)
-    {
-        accept();
-    }
+        const tcp::endpoint& endpoint, ws::capture *capture) :
+        handshake_limiter_(max_handshakes, max_handshakes_per_address),
+        acceptor_(io_service, endpoint, [this, capture](tcp::socket socket) {
+            std::make_shared<session>(std::move(socket), capture,
+                handshake_limiter_)->start();
+        }) { }
 
 private:
-    tcp::acceptor acceptor_;
-    tcp::socket socket_;
-
-    void accept() {
-        acceptor_.async_accept(socket_,
-            [this](const boost::system::error_code &ec)
-        {
-            if (!ec) {
-                std::make_shared<session>(std::move(socket_))->start();
-            }
-
-            accept();
-        });
-    }
+    /* Connections past this many still in their opening handshake, in all
+     * or from one address, are turned away with 503 */
+    enum {
+        max_handshakes = 4096,
+        max_handshakes_per_address = 64
+    };
+
+    ws::handshake_limiter handshake_limiter_;
+    ws::acceptor acceptor_;
 };
 
-int main(int, const char **) {
+int main(int argc, const char **argv) {
     const unsigned short PORT = 4567;
 
     try {
         boost::asio::io_service io_service;
         tcp::endpoint endpoint(tcp::v4(), PORT);
-        server server(io_service, endpoint);
+
+        /* echo_server [capture-file] records received frames for replay */
+        std::unique_ptr<ws::capture> capture;
+        if (argc > 1)
+            capture.reset(new ws::capture(argv[1]));
+
+        boost::asio::signal_set signals(io_service, SIGINT, SIGTERM);
+        signals.async_wait([&](const boost::system::error_code &, int) {
+            io_service.stop();
+        });
+
+        server server(io_service, endpoint, capture.get());
         io_service.run();
     } catch (std::exception& e) {
         std::cerr << "Exception: " << e.what() << "\n";
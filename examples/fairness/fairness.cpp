@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include "ws.hpp"
+
+/* Fairness of one io thread between a victim and a flooder: an echo server
+ * runs on its own thread, a victim client sends a small message every
+ * millisecond and times the echo, and flooder clients pipeline small
+ * messages as fast as the server takes them:
+ *
+ *     fairness [samples] [limit] [flooders]
+ *
+ * The victim's latency is measured alone, next to the flooders, and next to
+ * the flooders with every session limited to limit messages per second
+ * (default 5000). */
+
+using boost::asio::ip::tcp;
+typedef std::chrono::steady_clock clock_type;
+
+class session_base {
+public:
+    session_base(tcp::socket socket) : socket_(std::move(socket)) { }
+protected:
+    tcp::socket socket_;
+};
+
+using T = tcp::socket;
+class session : public session_base, public ws::session<T> {
+public:
+    session(tcp::socket socket, double limit) :
+        session_base(std::move(socket)), ws::session<T>(socket_),
+        limit_(limit) { }
+
+private:
+    double limit_;
+
+    void on_open() override {
+        if (limit_ > 0) {
+            ws::rate_limits limits;
+            limits.messages_per_second = limit_;
+            set_rate_limits(limits);
+        }
+    }
+
+    void on_msg(const ws::message &msg) override {
+        const ws::payload &payload = msg.get_payload();
+        write(msg.get_opcode(),
+            boost::asio::buffer(payload.data(), payload.size()), [this]()
+        {
+            read();
+        });
+    }
+
+    void on_close() override { }
+    void on_error() override { }
+};
+
+/* Echo server on its own io thread */
+class server {
+public:
+    explicit server(double limit) :
+        acceptor_(io_service_,
+            tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0),
+            [limit](tcp::socket socket) {
+                socket.set_option(tcp::no_delay(true));
+                std::make_shared<session>(std::move(socket), limit)->start();
+            }),
+        thread_([this]() { io_service_.run(); }) { }
+
+    ~server() {
+        io_service_.stop();
+        thread_.join();
+    }
+
+    tcp::endpoint endpoint() const {
+        return acceptor_.local_endpoint();
+    }
+
+private:
+    boost::asio::io_service io_service_;
+    ws::acceptor acceptor_;
+    std::thread thread_;
+};
+
+void handshake(tcp::socket &socket) {
+    const std::string request =
+        "GET / HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+        "Sec-WebSocket-Version: 13\r\n\r\n";
+    boost::asio::write(socket, boost::asio::buffer(request));
+
+    /* The server sends nothing after its response until we do */
+    boost::asio::streambuf response;
+    boost::asio::read_until(socket, response, "\r\n\r\n");
+}
+
+/* Masked 32 byte client frame */
+std::vector<unsigned char> client_frame() {
+    std::vector<unsigned char> frame = { 0x82, 0x80 | 32, 0, 0, 0, 0 };
+    frame.insert(frame.end(), 32, 'x');
+    return frame;
+}
+
+/* Pipelines frames in batches until stopped, draining the echoes on a
+ * second thread */
+class flooder {
+public:
+    flooder(boost::asio::io_service &io_service,
+        const tcp::endpoint &endpoint) :
+        socket_(io_service), stop_(false), received_(0)
+    {
+        socket_.connect(endpoint);
+        socket_.set_option(tcp::no_delay(true));
+        handshake(socket_);
+
+        std::vector<unsigned char> frame = client_frame();
+        for (std::size_t i = 0; i < 256; ++i)
+            batch_.insert(batch_.end(), frame.begin(), frame.end());
+
+        writer_ = std::thread([this]() { write(); });
+        reader_ = std::thread([this]() { read(); });
+    }
+
+    /* Messages echoed per second, each echo being a 34 byte unmasked frame */
+    double stop() {
+        stop_ = true;
+        writer_.join();
+        double seconds = std::chrono::duration<double>(
+            clock_type::now() - start_).count();
+        boost::system::error_code ignored;
+        socket_.shutdown(tcp::socket::shutdown_both, ignored);
+        reader_.join();
+        return received_ / 34 / seconds;
+    }
+
+private:
+    tcp::socket socket_;
+    std::vector<unsigned char> batch_;
+    std::atomic<bool> stop_;
+    std::atomic<std::size_t> received_;
+    clock_type::time_point start_;
+    std::thread writer_;
+    std::thread reader_;
+
+    void write() {
+        start_ = clock_type::now();
+        boost::system::error_code ec;
+        while (!stop_ && !ec)
+            boost::asio::write(socket_, boost::asio::buffer(batch_), ec);
+    }
+
+    void read() {
+        std::array<unsigned char, 64 * 1024> buffer;
+        boost::system::error_code ec;
+        while (!ec)
+            received_ += socket_.read_some(boost::asio::buffer(buffer), ec);
+    }
+};
+
+void victim(const std::string &name, const tcp::endpoint &endpoint,
+    std::size_t samples, std::size_t flooders)
+{
+    boost::asio::io_service io_service;
+    std::vector<std::unique_ptr<flooder>> flood;
+    for (std::size_t i = 0; i < flooders; ++i)
+        flood.emplace_back(new flooder(io_service, endpoint));
+    /* Let the flood build up */
+    if (flooders)
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    tcp::socket socket(io_service);
+    socket.connect(endpoint);
+    socket.set_option(tcp::no_delay(true));
+    handshake(socket);
+
+    std::vector<unsigned char> frame = client_frame();
+    std::array<unsigned char, 34> echo;
+    std::vector<double> latencies;
+    latencies.reserve(samples);
+    auto next = clock_type::now();
+    for (std::size_t i = 0; i < samples; ++i) {
+        next += std::chrono::milliseconds(1);
+        std::this_thread::sleep_until(next);
+
+        auto sent = clock_type::now();
+        boost::asio::write(socket, boost::asio::buffer(frame));
+        boost::asio::read(socket, boost::asio::buffer(echo));
+        latencies.push_back(std::chrono::duration<double, std::micro>(
+            clock_type::now() - sent).count());
+    }
+
+    double flood_rate = 0;
+    for (auto &f : flood)
+        flood_rate += f->stop();
+
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << name << ": victim p50 " << latencies[samples / 2]
+        << " us, p99 " << latencies[samples * 99 / 100] << " us, max "
+        << latencies.back() << " us";
+    if (flooders)
+        std::cout << ", flooders " << static_cast<std::size_t>(flood_rate)
+            << " msg/s";
+    std::cout << "\n";
+}
+
+int main(int argc, const char **argv) {
+    std::size_t samples = argc > 1 ? std::strtoul(argv[1], nullptr, 10) :
+        2000;
+    double limit = argc > 2 ? std::strtod(argv[2], nullptr) : 5000;
+    std::size_t flooders = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 4;
+    if (!samples || limit <= 0 || !flooders) {
+        std::cerr << "samples, limit and flooders must be positive\n";
+        return EXIT_FAILURE;
+    }
+
+    try {
+        {
+            server s(0);
+            victim("alone", s.endpoint(), samples, 0);
+            victim("flooded", s.endpoint(), samples, flooders);
+        }
+        {
+            server s(limit);
+            victim("flooded, limited", s.endpoint(), samples, flooders);
+        }
+    } catch (std::exception &e) {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
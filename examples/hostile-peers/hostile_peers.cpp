@@ -0,0 +1,348 @@
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include "ws.hpp"
+#include "ws/memory_stream.hpp"
+#include "ws/registry.hpp"
+
+/* Checks that misbehaving peers can't take a server down: each case runs an
+ * echo session over ws::memory_stream (or over loopback TCP, where the case
+ * needs a peer that stops reading) against a scripted peer and fails if an
+ * exception escapes the io_service or the session misbehaves:
+ *
+ *     hostile_peers
+ *
+ * Exits with a failure status if any case fails. */
+
+using boost::asio::ip::tcp;
+using T = ws::memory_stream;
+
+class session_base {
+public:
+    session_base(boost::asio::io_service &io_service) :
+        stream_(io_service) { }
+protected:
+    ws::memory_stream stream_;
+};
+
+class session : public session_base, public ws::session<T> {
+public:
+    session(boost::asio::io_service &io_service, bool batch) :
+        session_base(io_service), ws::session<T>(stream_), batching_(batch),
+        errors_(0) { }
+
+    ws::memory_stream &stream() {
+        return stream_;
+    }
+
+    std::size_t errors() const {
+        return errors_;
+    }
+
+private:
+    bool batching_;
+    std::size_t errors_;
+
+    void on_open() override {
+        set_message_batching(batching_);
+    }
+
+    void on_msg(const ws::message &msg) override {
+        const ws::payload &payload = msg.get_payload();
+        write(msg.get_opcode(),
+            boost::asio::buffer(payload.data(), payload.size()), [this]()
+        {
+            read();
+        });
+    }
+
+    void on_close() override { }
+    void on_error() override {
+        ++errors_;
+    }
+};
+
+/* Masked client frame header for a payload of length bytes, mask 0 */
+std::vector<unsigned char> client_header(ws::message::opcode opcode,
+    std::uint64_t length)
+{
+    std::array<unsigned char, ws::max_frame_header_length> header;
+    std::size_t header_length = ws::encode_frame_header(opcode, length,
+        header);
+    header[1] |= 0x80;
+
+    std::vector<unsigned char> frame(header.begin(),
+        header.begin() + header_length);
+    frame.insert(frame.end(), 4, 0);
+    return frame;
+}
+
+const std::string request =
+    "GET / HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Sec-WebSocket-Version: 13\r\n\r\n";
+
+/* A session and the peer's end of its stream */
+struct harness {
+    explicit harness(bool batch) :
+        s(std::make_shared<session>(io_service, batch)), peer(io_service)
+    {
+        ws::memory_stream::connect(s->stream(), peer);
+        s->start();
+    }
+
+    /* Queue bytes for the session, the write completes without it */
+    void send(const std::string &bytes) {
+        boost::asio::async_write(peer, boost::asio::buffer(bytes),
+            [](const boost::system::error_code &, std::size_t) { });
+    }
+
+    void send(const std::vector<unsigned char> &bytes) {
+        send(std::string(bytes.begin(), bytes.end()));
+    }
+
+    /* Run until the io_service is idle */
+    void run() {
+        io_service.restart();
+        io_service.run();
+    }
+
+    boost::asio::io_service io_service;
+    std::shared_ptr<session> s;
+    ws::memory_stream peer;
+};
+
+bool check(const std::string &name, const std::function<bool()> &f) {
+    bool passed;
+    try {
+        passed = f();
+    } catch (std::exception &e) {
+        std::cout << name << ": " << e.what() << "\n";
+        passed = false;
+    }
+    std::cout << (passed ? "PASS " : "FAIL ") << name << "\n";
+    return passed;
+}
+
+/* A header claiming far more payload than will ever arrive must not make
+ * the session allocate for it up front */
+bool oversized_length(bool batch, std::uint64_t length) {
+    harness h(batch);
+    h.send(request);
+    std::vector<unsigned char> frame = client_header(
+        ws::message::opcode::binary, length);
+    frame.insert(frame.end(), 100, 'x');
+    h.send(frame);
+    h.run();
+
+    h.peer.close();
+    h.run();
+    return true;
+}
+
+/* The status code the session answers an opening request with */
+std::string handshake_status(const std::string &opening) {
+    harness h(false);
+    h.send(opening);
+    boost::asio::streambuf response;
+    boost::asio::async_read_until(h.peer, response, "\r\n",
+        [](const boost::system::error_code &, std::size_t) { });
+    h.run();
+
+    std::string status;
+    std::istream(&response) >> status >> status;
+    h.peer.close();
+    h.run();
+    return status;
+}
+
+/* Replaces the first occurrence of from in the valid request with to */
+std::string request_with(const std::string &from, const std::string &to) {
+    std::string r = request;
+    r.replace(r.find(from), from.size(), to);
+    return r;
+}
+
+/* Echo session over TCP, noting when a message arrives */
+class tcp_session_base {
+public:
+    tcp_session_base(tcp::socket socket) : socket_(std::move(socket)) { }
+protected:
+    tcp::socket socket_;
+};
+
+class tcp_session : public tcp_session_base, public ws::session<tcp::socket> {
+public:
+    tcp_session(tcp::socket socket, std::atomic<bool> &received,
+        double limit) :
+        tcp_session_base(std::move(socket)),
+        ws::session<tcp::socket>(socket_), received_(received),
+        limit_(limit) { }
+
+private:
+    std::atomic<bool> &received_;
+    double limit_;
+
+    void on_open() override {
+        if (limit_ > 0) {
+            ws::rate_limits limits;
+            limits.messages_per_second = limit_;
+            set_rate_limits(limits);
+        }
+    }
+
+    void on_msg(const ws::message &) override {
+        received_ = true;
+        read();
+    }
+
+    void on_close() override { }
+    void on_error() override { }
+};
+
+std::size_t rss_kb() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+        if (line.compare(0, 6, "VmRSS:") == 0)
+            return std::strtoul(line.c_str() + 6, nullptr, 10);
+    return 0;
+}
+
+/* Pings sent without reading, then a text message, against a server
+ * whose sessions read at most limit messages per second if limit isn't 0.
+ * Returns the seconds until the text message arrived and sets rss_growth to
+ * what the process grew by meanwhile. */
+double ping_flood(std::size_t pings, double limit, std::size_t &rss_growth) {
+    boost::asio::io_service io_service;
+    std::atomic<bool> received(false);
+    ws::acceptor acceptor(io_service,
+        tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0),
+        [&received, limit](tcp::socket socket) {
+            socket.set_option(boost::asio::socket_base::send_buffer_size(
+                4096));
+            std::make_shared<tcp_session>(std::move(socket), received,
+                limit)->start();
+        });
+    std::thread server([&io_service]() { io_service.run(); });
+
+    boost::asio::io_service client_io_service;
+    tcp::socket socket(client_io_service);
+    socket.open(tcp::v4());
+    socket.set_option(boost::asio::socket_base::receive_buffer_size(4096));
+    socket.connect(acceptor.local_endpoint());
+    boost::asio::write(socket, boost::asio::buffer(request));
+    boost::asio::streambuf response;
+    boost::asio::read_until(socket, response, "\r\n\r\n");
+
+    std::vector<unsigned char> ping = client_header(
+        ws::message::opcode::ping, 125);
+    ping.insert(ping.end(), 125, 'x');
+    std::vector<unsigned char> pings_batch;
+    for (std::size_t i = 0; i < 1000; ++i)
+        pings_batch.insert(pings_batch.end(), ping.begin(), ping.end());
+    std::vector<unsigned char> last = client_header(
+        ws::message::opcode::text, 0);
+
+    std::size_t before = rss_kb();
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < pings / 1000; ++i)
+        boost::asio::write(socket, boost::asio::buffer(pings_batch));
+    boost::asio::write(socket, boost::asio::buffer(last));
+    while (!received)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    rss_growth = rss_kb() - before;
+
+    io_service.stop();
+    server.join();
+    return seconds;
+}
+
+/* A peer that pings without ever reading must not make the server queue a
+ * pong per ping */
+bool unread_pongs() {
+    std::size_t rss_growth;
+    ping_flood(200000, 0, rss_growth);
+    std::cout << "ping flood: RSS grew " << rss_growth << " kB\n";
+    return rss_growth < 8 * 1024;
+}
+
+/* Pings count against a session's message limit: 20000 of them at 10000
+ * a second, a burst of 10000 included, take about a second to get through */
+bool rate_limited_pings() {
+    std::size_t rss_growth;
+    double seconds = ping_flood(20000, 10000, rss_growth);
+    std::cout << "rate limited pings: " << seconds << " s\n";
+    return seconds > 0.5;
+}
+
+struct registered {
+    void send(ws::frame_ptr) { }
+};
+
+/* Sessions that fail or lose their peer never call remove(): past a shard's
+ * 2^24 slots, add() must reuse theirs rather than throw. A remove() from
+ * another thread takes effect once the owning io_service runs. */
+bool leaked_registry_slots() {
+    boost::asio::io_service io_service;
+    std::vector<boost::asio::io_service *> shards{ &io_service };
+    ws::registry<registered> registry(shards);
+    for (std::size_t i = 0; i < (1 << 24) + 1000; ++i)
+        registry.add(io_service, std::make_shared<registered>());
+
+    auto s = std::make_shared<registered>();
+    auto id = registry.add(io_service, s);
+    std::thread([&registry, id]() { registry.remove(id); }).join();
+    bool found = registry.find(id) != nullptr;
+    io_service.run();
+    return found && !registry.find(id);
+}
+
+int main() {
+    bool passed = true;
+    for (bool batch : { false, true }) {
+        std::string mode = batch ? " (batching)" : "";
+        passed &= check("oversized length 2^40" + mode,
+            [batch]() { return oversized_length(batch, 1ULL << 40); });
+        passed &= check("oversized length 8 GiB" + mode,
+            [batch]() { return oversized_length(batch, 8ULL << 30); });
+    }
+    passed &= check("valid request upgrades", []() {
+        return handshake_status(request) == "101";
+    });
+    passed &= check("request without Upgrade is refused", []() {
+        return handshake_status(request_with("Upgrade: websocket\r\n", "")) ==
+            "400";
+    });
+    passed &= check("POST request is refused", []() {
+        return handshake_status(request_with("GET", "POST")) == "400";
+    });
+    passed &= check("short key is refused", []() {
+        return handshake_status(request_with("dGhlIHNhbXBsZSBub25jZQ==",
+            "c2hvcnQ=")) == "400";
+    });
+    passed &= check("version 12 gets 426", []() {
+        return handshake_status(request_with("Version: 13", "Version: 12")) ==
+            "426";
+    });
+    passed &= check("registry slots of unremoved sessions are reused",
+        leaked_registry_slots);
+    passed &= check("ping flood without reading", unread_pongs);
+    passed &= check("pings are rate limited", rate_limited_pings);
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
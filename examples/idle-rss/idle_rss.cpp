@@ -0,0 +1,186 @@
+#include <array>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <boost/asio.hpp>
+#include "ws.hpp"
+
+/* Resident memory of idle connections: an echo server runs in a child
+ * process; the parent opens connections to it over loopback, sends one
+ * message on each (which sizes the session's receive buffer) and leaves
+ * them idle, then reads the server's VmRSS. Done once with sessions keeping
+ * their receive buffers and once with set_release_idle_buffer(true):
+ *
+ *     idle_rss [connections] [size]
+ *
+ * Both ends hold a descriptor per connection, so the open file limit must
+ * be above connections plus a few. */
+
+using boost::asio::ip::tcp;
+
+class session_base {
+public:
+    session_base(tcp::socket socket) : socket_(std::move(socket)) { }
+protected:
+    tcp::socket socket_;
+};
+
+using T = tcp::socket;
+class session : public session_base, public ws::session<T> {
+public:
+    session(tcp::socket socket, bool release_idle_buffer) :
+        session_base(std::move(socket)), ws::session<T>(socket_),
+        release_idle_buffer_(release_idle_buffer) { }
+
+private:
+    bool release_idle_buffer_;
+
+    void on_open() override {
+        set_release_idle_buffer(release_idle_buffer_);
+    }
+
+    void on_msg(const ws::message &msg) override {
+        const ws::payload &payload = msg.get_payload();
+        write(msg.get_opcode(),
+            boost::asio::buffer(payload.data(), payload.size()), [this]()
+        {
+            read();
+        });
+    }
+
+    void on_close() override { }
+    void on_error() override { }
+};
+
+/* Serves until killed, writing the port to ready once listening */
+void serve(int ready, bool release_idle_buffer) {
+    boost::asio::io_service io_service;
+    ws::acceptor acceptor(io_service,
+        tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0),
+        [release_idle_buffer](tcp::socket socket) {
+            std::make_shared<session>(std::move(socket),
+                release_idle_buffer)->start();
+        });
+
+    unsigned short port = acceptor.local_endpoint().port();
+    if (::write(ready, &port, sizeof (port)) != sizeof (port))
+        std::exit(EXIT_FAILURE);
+    ::close(ready);
+    io_service.run();
+}
+
+std::size_t rss_kb(pid_t pid) {
+    std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+    std::string line;
+    while (std::getline(status, line))
+        if (line.compare(0, 6, "VmRSS:") == 0)
+            return std::strtoul(line.c_str() + 6, nullptr, 10);
+    return 0;
+}
+
+/* Masked client frame */
+std::vector<unsigned char> client_frame(std::size_t size) {
+    std::array<unsigned char, ws::max_frame_header_length> header;
+    std::size_t header_length = ws::encode_frame_header(
+        ws::message::opcode::binary, size, header);
+    header[1] |= 0x80;
+
+    std::vector<unsigned char> frame(header.begin(),
+        header.begin() + header_length);
+    frame.insert(frame.end(), 4, 0);
+    frame.insert(frame.end(), size, 'x');
+    return frame;
+}
+
+void run(const char *name, bool release_idle_buffer,
+    std::size_t connections, std::size_t size)
+{
+    int ready[2];
+    if (::pipe(ready) != 0)
+        throw std::runtime_error("pipe");
+    pid_t pid = ::fork();
+    if (pid < 0)
+        throw std::runtime_error("fork");
+    if (pid == 0) {
+        ::close(ready[0]);
+        serve(ready[1], release_idle_buffer);
+        std::exit(EXIT_SUCCESS);
+    }
+    ::close(ready[1]);
+    unsigned short port;
+    if (::read(ready[0], &port, sizeof (port)) != sizeof (port))
+        throw std::runtime_error("server didn't start");
+    ::close(ready[0]);
+
+    std::size_t before = rss_kb(pid);
+
+    const std::string request =
+        "GET / HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+        "Sec-WebSocket-Version: 13\r\n\r\n";
+    std::vector<unsigned char> frame = client_frame(size);
+    std::size_t header_length = size < 126 ? 2 : size < 65536 ? 4 : 10;
+    std::vector<unsigned char> echo(header_length + size);
+
+    boost::asio::io_service io_service;
+    tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), port);
+    std::vector<std::unique_ptr<tcp::socket>> sockets;
+    for (std::size_t i = 0; i < connections; ++i) {
+        std::unique_ptr<tcp::socket> socket(new tcp::socket(io_service));
+        socket->connect(endpoint);
+        boost::asio::write(*socket, boost::asio::buffer(request));
+        boost::asio::streambuf response;
+        boost::asio::read_until(*socket, response, "\r\n\r\n");
+
+        boost::asio::write(*socket, boost::asio::buffer(frame));
+        boost::asio::read(*socket, boost::asio::buffer(echo));
+        sockets.push_back(std::move(socket));
+    }
+
+    std::size_t after = rss_kb(pid);
+    std::cout << name << ": " << connections << " idle connections, server "
+        << "RSS " << before << " kB -> " << after << " kB, "
+        << (after - before) * 1024.0 / connections << " bytes/connection\n";
+
+    ::kill(pid, SIGTERM);
+    ::waitpid(pid, nullptr, 0);
+}
+
+int main(int argc, const char **argv) {
+    std::size_t connections = argc > 1 ?
+        std::strtoul(argv[1], nullptr, 10) : 5000;
+    std::size_t size = argc > 2 ? std::strtoul(argv[2], nullptr, 10) :
+        16 * 1024;
+    if (!connections) {
+        std::cerr << "connections must be positive\n";
+        return EXIT_FAILURE;
+    }
+
+    rlimit limit;
+    if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+        limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    try {
+        run("buffers kept", false, connections, size);
+        run("buffers released", true, connections, size);
+    } catch (std::exception &e) {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
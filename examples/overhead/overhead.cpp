@@ -0,0 +1,312 @@
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include "ws.hpp"
+#include "ws/memory_stream.hpp"
+
+/* Library overhead without the kernel: an echo session and a client driver
+ * joined by ws::memory_stream on one thread. The driver sends frames in
+ * windows of pipelined frames and waits for all the echoes before sending
+ * the next window.
+ *
+ *     overhead [--static] [--batch] [frames] [size] [window] [chunk]
+ *
+ * chunk, if given, caps every read and write on both ends to simulate
+ * partial transfers. The session is a ws::session, with its handlers called
+ * through virtual functions, or with --static the same session built on
+ * ws::basic_session with its handlers resolved at compile time. --batch
+ * turns on message batching and idle buffer release from on_open(). */
+
+static std::size_t allocations = 0;
+
+void *operator new(std::size_t size) {
+    ++allocations;
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+/* Out of line, or gcc pairs the inlined free() with new expressions and
+ * warns about a mismatch */
+__attribute__((noinline))
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline))
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+typedef std::chrono::steady_clock clock_type;
+
+class session_base {
+public:
+    session_base(boost::asio::io_service &io_service, std::size_t chunk,
+        bool batch) :
+        stream_(io_service, chunk), batching_(batch) { }
+protected:
+    ws::memory_stream stream_;
+    bool batching_;
+};
+
+using T = ws::memory_stream;
+
+/* Echo session with virtual handlers */
+class session : public session_base, public ws::session<T> {
+public:
+    session(boost::asio::io_service &io_service, std::size_t chunk,
+        bool batch) :
+        session_base(io_service, chunk, batch), ws::session<T>(stream_) { }
+
+    ws::memory_stream &stream() {
+        return stream_;
+    }
+
+private:
+    void on_open() override {
+        set_message_batching(batching_);
+        set_release_idle_buffer(batching_);
+    }
+
+    void on_msg(const ws::message &msg) override {
+        const ws::payload &payload = msg.get_payload();
+        write(msg.get_opcode(),
+            boost::asio::buffer(payload.data(), payload.size()), [this]()
+        {
+            read();
+        });
+    }
+
+    void on_close() override { }
+    void on_error() override {
+        std::cerr << "session error\n";
+    }
+};
+
+/* The same session with handlers resolved at compile time */
+class static_session : public session_base,
+    public ws::basic_session<static_session, T, ws::default_policies>
+{
+    friend class ws::session_access;
+
+public:
+    static_session(boost::asio::io_service &io_service, std::size_t chunk,
+        bool batch) :
+        session_base(io_service, chunk, batch), basic_session(stream_) { }
+
+    ws::memory_stream &stream() {
+        return stream_;
+    }
+
+private:
+    void on_open() {
+        set_message_batching(batching_);
+        set_release_idle_buffer(batching_);
+    }
+
+    void on_msg(const ws::message &msg) {
+        const ws::payload &payload = msg.get_payload();
+        write(msg.get_opcode(),
+            boost::asio::buffer(payload.data(), payload.size()), [this]()
+        {
+            read();
+        });
+    }
+
+    void on_close() { }
+    void on_error() {
+        std::cerr << "session error\n";
+    }
+};
+
+class driver {
+public:
+    driver(boost::asio::io_service &io_service, std::size_t chunk,
+        std::size_t frames, std::size_t size, std::size_t window) :
+        stream_(io_service, chunk), frames_(frames), window_(window),
+        sent_(0), received_(0), allocations_(0)
+    {
+        /* One window of masked client frames, encoded once */
+        std::array<unsigned char, ws::max_frame_header_length> header;
+        std::size_t header_length = ws::encode_frame_header(
+            ws::message::opcode::binary, size, header);
+        header[1] |= 0x80;
+        for (std::size_t i = 0; i < window_; ++i) {
+            batch_.insert(batch_.end(), header.begin(),
+                header.begin() + header_length);
+            batch_.insert(batch_.end(), 4, 0x5a);
+            batch_.insert(batch_.end(), size, 'x' ^ 0x5a);
+        }
+    }
+
+    ws::memory_stream &stream() {
+        return stream_;
+    }
+
+    void start() {
+        request_ =
+            "GET / HTTP/1.1\r\n"
+            "Host: localhost\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+            "Sec-WebSocket-Version: 13\r\n\r\n";
+
+        boost::asio::async_write(stream_, boost::asio::buffer(request_),
+            [this](const boost::system::error_code &ec, std::size_t)
+        {
+            if (ec)
+                return;
+
+            boost::asio::async_read_until(stream_, in_, "\r\n\r\n",
+                [this](const boost::system::error_code &ec, std::size_t n)
+            {
+                if (ec)
+                    return;
+
+                in_.consume(n);
+                allocations_ = allocations;
+                start_ = clock_type::now();
+                send_window();
+            });
+        });
+    }
+
+    void report() const {
+        double ns = std::chrono::duration<double, std::nano>(
+            end_ - start_).count();
+        std::cout << received_ << " frames, " << ns / received_
+            << " ns/frame, " << double(end_allocations_ - allocations_) /
+            received_ << " allocations/frame\n";
+    }
+
+private:
+    ws::memory_stream stream_;
+    std::size_t frames_;
+    std::size_t window_;
+    std::size_t sent_;
+    std::size_t received_;
+    std::vector<unsigned char> batch_;
+    std::string request_;
+    boost::asio::streambuf in_;
+    clock_type::time_point start_;
+    clock_type::time_point end_;
+    std::size_t allocations_;
+    std::size_t end_allocations_;
+
+    void send_window() {
+        sent_ += window_;
+        boost::asio::async_write(stream_, boost::asio::buffer(batch_),
+            [this](const boost::system::error_code &ec, std::size_t)
+        {
+            if (!ec)
+                receive();
+        });
+    }
+
+    void receive() {
+        /* Count the complete echoes buffered so far */
+        for (;;) {
+            const unsigned char *p = boost::asio::buffer_cast<
+                const unsigned char *>(in_.data());
+            std::size_t available = in_.size();
+            if (available < 2)
+                break;
+
+            std::size_t header_length = 2;
+            std::size_t length = p[1] & 0x7f;
+            if (length == 126) {
+                header_length = 4;
+                if (available < header_length)
+                    break;
+                length = p[2] << 8 | p[3];
+            } else if (length == 127) {
+                header_length = 10;
+                if (available < header_length)
+                    break;
+                length = 0;
+                for (std::size_t i = 0; i < 8; ++i)
+                    length = length << 8 | p[2 + i];
+            }
+            if (available < header_length + length)
+                break;
+
+            in_.consume(header_length + length);
+            ++received_;
+        }
+
+        if (received_ == sent_) {
+            if (sent_ >= frames_) {
+                end_ = clock_type::now();
+                end_allocations_ = allocations;
+                stream_.close();
+            } else {
+                send_window();
+            }
+            return;
+        }
+
+        stream_.async_read_some(in_.prepare(64 * 1024),
+            [this](const boost::system::error_code &ec, std::size_t n)
+        {
+            if (ec)
+                return;
+
+            in_.commit(n);
+            receive();
+        });
+    }
+};
+
+template <typename Session>
+void run(std::size_t frames, std::size_t size, std::size_t window,
+    std::size_t chunk, bool batch)
+{
+    boost::asio::io_service io_service;
+    auto s = std::make_shared<Session>(io_service, chunk, batch);
+    driver d(io_service, chunk, frames, size, window);
+    ws::memory_stream::connect(s->stream(), d.stream());
+
+    s->start();
+    d.start();
+    io_service.run();
+    d.report();
+}
+
+int main(int argc, const char **argv) {
+    bool static_dispatch = false;
+    bool batch = false;
+    std::vector<std::size_t> args;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--static") == 0)
+            static_dispatch = true;
+        else if (std::strcmp(argv[i], "--batch") == 0)
+            batch = true;
+        else
+            args.push_back(std::strtoul(argv[i], nullptr, 10));
+    }
+
+    std::size_t frames = args.size() > 0 ? args[0] : 1000000;
+    std::size_t size = args.size() > 1 ? args[1] : 32;
+    std::size_t window = args.size() > 2 ? args[2] : 16;
+    std::size_t chunk = args.size() > 3 ? args[3] : 0;
+    if (!frames || !window) {
+        std::cerr << "frames and window must be positive\n";
+        return EXIT_FAILURE;
+    }
+
+    if (static_dispatch)
+        run<static_session>(frames, size, window, chunk, batch);
+    else
+        run<session>(frames, size, window, chunk, batch);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include "ws/frame.hpp"
+
+/* Round-trip latency and throughput of small messages against an echo
+ * server, over TCP or a Unix domain socket:
+ *
+ *     pingpong tcp <host> <port> [count] [size]
+ *     pingpong unix <path> [count] [size]
+ *
+ * Each message is sent once the previous echo has arrived. */
+
+using boost::asio::ip::tcp;
+using boost::asio::local::stream_protocol;
+typedef std::chrono::steady_clock clock_type;
+
+template <typename Socket>
+void handshake(Socket &socket) {
+    const std::string request =
+        "GET / HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+        "Sec-WebSocket-Version: 13\r\n\r\n";
+    boost::asio::write(socket, boost::asio::buffer(request));
+
+    /* The server sends nothing after its response until we do */
+    boost::asio::streambuf response;
+    boost::asio::read_until(socket, response, "\r\n\r\n");
+}
+
+/* Masked client frame */
+std::vector<unsigned char> client_frame(ws::message::opcode opcode,
+    const std::vector<unsigned char> &payload)
+{
+    std::array<unsigned char, ws::max_frame_header_length> header;
+    std::size_t header_length = ws::encode_frame_header(opcode,
+        payload.size(), header);
+    header[1] |= 0x80;
+
+    const std::array<unsigned char, 4> mask = {{ 0x12, 0x34, 0x56, 0x78 }};
+    std::vector<unsigned char> frame(header.begin(),
+        header.begin() + header_length);
+    frame.insert(frame.end(), mask.begin(), mask.end());
+    for (std::size_t i = 0; i < payload.size(); ++i)
+        frame.push_back(payload[i] ^ mask[i % 4]);
+    return frame;
+}
+
+/* Read one unmasked server frame into payload */
+template <typename Socket>
+void read_frame(Socket &socket, std::vector<unsigned char> &payload) {
+    std::array<unsigned char, 8> header;
+    boost::asio::read(socket, boost::asio::buffer(header.data(), 2));
+
+    std::size_t length = header[1] & 0x7f;
+    if (length == 126) {
+        boost::asio::read(socket, boost::asio::buffer(header.data(), 2));
+        length = header[0] << 8 | header[1];
+    } else if (length == 127) {
+        boost::asio::read(socket, boost::asio::buffer(header.data(), 8));
+        length = 0;
+        for (std::size_t i = 0; i < 8; ++i)
+            length = length << 8 | header[i];
+    }
+
+    payload.resize(length);
+    boost::asio::read(socket, boost::asio::buffer(payload));
+}
+
+template <typename Socket>
+void run(Socket &socket, const std::string &name, std::size_t count,
+    std::size_t size)
+{
+    handshake(socket);
+
+    std::vector<unsigned char> frame = client_frame(
+        ws::message::opcode::binary, std::vector<unsigned char>(size, 'x'));
+    std::vector<unsigned char> reply;
+
+    /* Warm up */
+    for (std::size_t i = 0; i < std::min<std::size_t>(count, 1000); ++i) {
+        boost::asio::write(socket, boost::asio::buffer(frame));
+        read_frame(socket, reply);
+    }
+
+    std::vector<double> latencies;
+    latencies.reserve(count);
+    auto start = clock_type::now();
+    for (std::size_t i = 0; i < count; ++i) {
+        auto sent = clock_type::now();
+        boost::asio::write(socket, boost::asio::buffer(frame));
+        read_frame(socket, reply);
+        latencies.push_back(std::chrono::duration<double, std::micro>(
+            clock_type::now() - sent).count());
+    }
+    double seconds = std::chrono::duration<double>(
+        clock_type::now() - start).count();
+
+    frame = client_frame(ws::message::opcode::connection_close, {});
+    boost::asio::write(socket, boost::asio::buffer(frame));
+    read_frame(socket, reply);
+
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << name << ": " << count << " round trips of " << size
+        << " bytes, p50 " << latencies[count / 2] << " us, p99 "
+        << latencies[count * 99 / 100] << " us, "
+        << static_cast<std::size_t>(count / seconds) << " round trips/s\n";
+}
+
+int main(int argc, const char **argv) {
+    std::string transport = argc > 1 ? argv[1] : "";
+    std::size_t arg = transport == "tcp" ? 4 : 3;
+    if ((transport != "tcp" && transport != "unix") ||
+        argc < static_cast<int>(arg))
+    {
+        std::cerr << "Usage: pingpong tcp <host> <port> [count] [size]\n"
+            << "       pingpong unix <path> [count] [size]\n";
+        return EXIT_FAILURE;
+    }
+    std::size_t count = argc > static_cast<int>(arg) ?
+        std::strtoul(argv[arg], nullptr, 10) : 100000;
+    std::size_t size = argc > static_cast<int>(arg + 1) ?
+        std::strtoul(argv[arg + 1], nullptr, 10) : 32;
+    if (!count) {
+        std::cerr << "count must be positive\n";
+        return EXIT_FAILURE;
+    }
+
+    try {
+        boost::asio::io_service io_service;
+        if (transport == "tcp") {
+            tcp::socket socket(io_service);
+            tcp::resolver resolver(io_service);
+            boost::asio::connect(socket, resolver.resolve(argv[2], argv[3]));
+            socket.set_option(tcp::no_delay(true));
+            run(socket, "tcp", count, size);
+        } else {
+            stream_protocol::socket socket(io_service);
+            socket.connect(stream_protocol::endpoint(argv[2]));
+            run(socket, "unix", count, size);
+        }
+    } catch (std::exception &e) {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,239 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include "ws.hpp"
+
+/* Control frame latency behind bulk data: an in-process server sends one
+ * large binary message, and once its data starts arriving the client pings
+ * every millisecond and times each pong:
+ *
+ *     pong_latency [megabytes] [fragment]
+ *
+ * Run once with the message sent as a single frame, which a pong can't
+ * interrupt, and once split into fragments of fragment bytes (default
+ * 64 KiB), between which pongs skip ahead of the rest of the data. The time
+ * until the first data arrives is reported separately; it is spent filling
+ * and encoding the message, during which the server's io thread is busy. */
+
+using boost::asio::ip::tcp;
+typedef std::chrono::steady_clock clock_type;
+
+class session_base {
+public:
+    session_base(tcp::socket socket) : socket_(std::move(socket)) { }
+protected:
+    tcp::socket socket_;
+};
+
+/* Answers "send <bytes> <fragment size>" with one binary message */
+using T = tcp::socket;
+class session : public session_base, public ws::session<T> {
+public:
+    session(tcp::socket socket) : session_base(std::move(socket)),
+        ws::session<T>(socket_) { }
+
+private:
+    std::vector<unsigned char> body_;
+
+    void on_open() override { }
+
+    void on_msg(const ws::message &msg) override {
+        const ws::payload &payload = msg.get_payload();
+        std::istringstream command(std::string(payload.begin(),
+            payload.end()));
+        std::string verb;
+        std::size_t bytes = 0;
+        std::size_t fragment = 0;
+        command >> verb >> bytes >> fragment;
+
+        if (verb == "send") {
+            body_.assign(bytes, 'x');
+            set_fragment_size(fragment);
+            write(ws::message::opcode::binary, boost::asio::buffer(body_),
+                nullptr);
+        }
+        read();
+    }
+
+    void on_close() override { }
+    void on_error() override { }
+};
+
+/* Masked client frame */
+std::vector<unsigned char> client_frame(ws::message::opcode opcode,
+    const std::string &payload)
+{
+    std::array<unsigned char, ws::max_frame_header_length> header;
+    std::size_t header_length = ws::encode_frame_header(opcode,
+        payload.size(), header);
+    header[1] |= 0x80;
+
+    const std::array<unsigned char, 4> mask = {{ 0x12, 0x34, 0x56, 0x78 }};
+    std::vector<unsigned char> frame(header.begin(),
+        header.begin() + header_length);
+    frame.insert(frame.end(), mask.begin(), mask.end());
+    for (std::size_t i = 0; i < payload.size(); ++i)
+        frame.push_back(payload[i] ^ mask[i % 4]);
+    return frame;
+}
+
+/* Reads server frames until bytes of data have arrived, timing the pongs
+ * against the send times recorded by the pinger */
+void receive(tcp::socket &socket, std::size_t bytes,
+    const std::vector<clock_type::time_point> &sent,
+    std::vector<double> &latencies, std::atomic<bool> &streaming,
+    std::atomic<bool> &done)
+{
+    std::vector<unsigned char> buffer(64 * 1024);
+    std::size_t received = 0;
+    while (received < bytes) {
+        std::array<unsigned char, 8> header;
+        boost::asio::read(socket, boost::asio::buffer(header.data(), 2));
+        unsigned char opcode = header[0] & 0x0f;
+
+        std::size_t length = header[1] & 0x7f;
+        if (length == 126) {
+            boost::asio::read(socket, boost::asio::buffer(header.data(), 2));
+            length = header[0] << 8 | header[1];
+        } else if (length == 127) {
+            boost::asio::read(socket, boost::asio::buffer(header.data(), 8));
+            length = 0;
+            for (std::size_t i = 0; i < 8; ++i)
+                length = length << 8 | header[i];
+        }
+
+        if (opcode == 0xa) {
+            /* Pong, echoing the ping's sequence number */
+            boost::asio::read(socket, boost::asio::buffer(buffer, length));
+            std::size_t seq = std::strtoul(std::string(buffer.begin(),
+                buffer.begin() + length).c_str(), nullptr, 10);
+            latencies.push_back(std::chrono::duration<double, std::milli>(
+                clock_type::now() - sent[seq]).count());
+            continue;
+        }
+
+        while (length) {
+            std::size_t n = boost::asio::read(socket, boost::asio::buffer(
+                buffer, std::min(length, buffer.size())));
+            length -= n;
+            received += n;
+            streaming = true;
+        }
+    }
+    done = true;
+}
+
+void run(const tcp::endpoint &endpoint, std::size_t bytes,
+    std::size_t fragment)
+{
+    boost::asio::io_service io_service;
+    tcp::socket socket(io_service);
+    socket.connect(endpoint);
+    socket.set_option(tcp::no_delay(true));
+
+    const std::string request =
+        "GET / HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+        "Sec-WebSocket-Version: 13\r\n\r\n";
+    boost::asio::write(socket, boost::asio::buffer(request));
+    boost::asio::streambuf response;
+    boost::asio::read_until(socket, response, "\r\n\r\n");
+
+    std::ostringstream command;
+    command << "send " << bytes << " " << fragment;
+    std::vector<unsigned char> frame = client_frame(
+        ws::message::opcode::text, command.str());
+
+    /* One send time per possible ping, so the reader never sees the
+     * vector move */
+    std::vector<clock_type::time_point> sent(100000);
+    std::vector<double> latencies;
+    std::atomic<bool> streaming(false);
+    std::atomic<bool> done(false);
+
+    auto start = clock_type::now();
+    boost::asio::write(socket, boost::asio::buffer(frame));
+    std::thread reader([&]() {
+        receive(socket, bytes, sent, latencies, streaming, done);
+    });
+
+    while (!streaming)
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    double first_data = std::chrono::duration<double, std::milli>(
+        clock_type::now() - start).count();
+
+    std::size_t pings = 0;
+    auto next = clock_type::now();
+    while (!done && pings < sent.size()) {
+        sent[pings] = clock_type::now();
+        frame = client_frame(ws::message::opcode::ping,
+            std::to_string(pings));
+        boost::asio::write(socket, boost::asio::buffer(frame));
+        ++pings;
+
+        next += std::chrono::milliseconds(1);
+        std::this_thread::sleep_until(next);
+    }
+    reader.join();
+    double seconds = std::chrono::duration<double>(
+        clock_type::now() - start).count();
+
+    std::cout << (fragment ? "fragments of " + std::to_string(fragment) +
+        " bytes" : std::string("single frame")) << ": first data after "
+        << first_data << " ms, " << bytes / seconds / (1024 * 1024)
+        << " MiB/s, " << latencies.size() << " of " << pings
+        << " pongs during the message";
+    if (!latencies.empty()) {
+        std::sort(latencies.begin(), latencies.end());
+        std::cout << ", p50 " << latencies[latencies.size() / 2]
+            << " ms, p99 " << latencies[latencies.size() * 99 / 100]
+            << " ms, max " << latencies.back() << " ms";
+    }
+    std::cout << "\n";
+}
+
+int main(int argc, const char **argv) {
+    std::size_t megabytes = argc > 1 ?
+        std::strtoul(argv[1], nullptr, 10) : 100;
+    std::size_t fragment = argc > 2 ?
+        std::strtoul(argv[2], nullptr, 10) : 64 * 1024;
+    if (!megabytes || !fragment) {
+        std::cerr << "megabytes and fragment must be positive\n";
+        return EXIT_FAILURE;
+    }
+
+    try {
+        boost::asio::io_service io_service;
+        ws::acceptor acceptor(io_service,
+            tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0),
+            [](tcp::socket socket) {
+                socket.set_option(tcp::no_delay(true));
+                std::make_shared<session>(std::move(socket))->start();
+            });
+        std::thread server([&io_service]() { io_service.run(); });
+
+        run(acceptor.local_endpoint(), megabytes * 1000 * 1000, 0);
+        run(acceptor.local_endpoint(), megabytes * 1000 * 1000, fragment);
+
+        io_service.stop();
+        server.join();
+    } catch (std::exception &e) {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
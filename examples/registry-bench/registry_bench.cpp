@@ -0,0 +1,106 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include "ws/registry.hpp"
+
+/* Cross-thread send_to() throughput: sessions are spread over shards, each
+ * an io_service run by its own thread, and producer threads send a shared
+ * frame to them round-robin by id:
+ *
+ *     registry_bench [sends] [producers] [shards] [sessions]
+ *
+ * The sessions only count what they are handed, so the figure is the cost
+ * of the registry's queues and lookups, not of writing to sockets. */
+
+typedef std::chrono::steady_clock clock_type;
+
+class counting_session {
+public:
+    explicit counting_session(std::atomic<std::size_t> &delivered) :
+        delivered_(delivered) { }
+
+    void send(ws::frame_ptr) {
+        delivered_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<std::size_t> &delivered_;
+};
+
+int main(int argc, const char **argv) {
+    std::size_t sends = argc > 1 ? std::strtoul(argv[1], nullptr, 10) :
+        8000000;
+    std::size_t producers = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4;
+    std::size_t shards = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 2;
+    std::size_t sessions = argc > 4 ? std::strtoul(argv[4], nullptr, 10) :
+        1000;
+    if (!sends || !producers || !shards || !sessions) {
+        std::cerr << "sends, producers, shards and sessions must be "
+            "positive\n";
+        return EXIT_FAILURE;
+    }
+
+    try {
+        std::vector<std::unique_ptr<boost::asio::io_service>> io_services;
+        std::vector<boost::asio::io_service *> pointers;
+        for (std::size_t i = 0; i < shards; ++i) {
+            io_services.emplace_back(new boost::asio::io_service);
+            pointers.push_back(io_services.back().get());
+        }
+        ws::registry<counting_session> registry(pointers);
+
+        /* Registered before the io threads start, which is then the same as
+         * registering on them */
+        std::atomic<std::size_t> delivered(0);
+        std::vector<std::shared_ptr<counting_session>> s;
+        std::vector<ws::registry<counting_session>::id_type> ids;
+        for (std::size_t i = 0; i < sessions; ++i) {
+            s.push_back(std::make_shared<counting_session>(delivered));
+            ids.push_back(registry.add(*pointers[i % shards], s.back()));
+        }
+
+        std::vector<std::unique_ptr<boost::asio::io_service::work>> work;
+        std::vector<std::thread> io_threads;
+        for (auto io_service : pointers) {
+            work.emplace_back(new boost::asio::io_service::work(*io_service));
+            io_threads.emplace_back([io_service]() { io_service->run(); });
+        }
+
+        ws::frame_ptr frame = ws::make_frame(ws::message::opcode::text,
+            boost::asio::buffer("hello", 5));
+
+        auto start = clock_type::now();
+        std::vector<std::thread> threads;
+        for (std::size_t p = 0; p < producers; ++p) {
+            std::size_t share = sends / producers +
+                (p < sends % producers ? 1 : 0);
+            threads.emplace_back([&, p, share]() {
+                for (std::size_t i = 0; i < share; ++i)
+                    registry.send_to(ids[(i + p) % ids.size()], frame);
+            });
+        }
+        for (auto &t : threads)
+            t.join();
+        while (delivered < sends)
+            std::this_thread::yield();
+        double seconds = std::chrono::duration<double>(
+            clock_type::now() - start).count();
+
+        work.clear();
+        for (auto &t : io_threads)
+            t.join();
+
+        std::cout << producers << " producers, " << shards << " shards: "
+            << sends / seconds / 1e6 << " M sends/s\n";
+    } catch (std::exception &e) {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,263 @@
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/asio.hpp>
+#include "ws/capture.hpp"
+#include "ws/frame.hpp"
+
+/* Replays a file written by ws::capture against a server: one client
+ * connection per recorded session, each frame sent (masked, as a client must)
+ * at its recorded offset from the start of the capture divided by speed.
+ * Hashed records are replayed as filler of the original length. Replies are
+ * read and discarded. */
+
+using boost::asio::ip::tcp;
+typedef std::chrono::steady_clock clock_type;
+
+class mapped_file {
+public:
+    explicit mapped_file(const char *path) : data_(nullptr), size_(0) {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error(std::string("unable to open ") + path);
+
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            size_ = st.st_size;
+            void *p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED)
+                data_ = static_cast<const unsigned char *>(p);
+        }
+        ::close(fd);
+        if (!data_)
+            throw std::runtime_error(std::string("unable to map ") + path);
+    }
+
+    ~mapped_file() {
+        ::munmap(const_cast<unsigned char *>(data_), size_);
+    }
+
+    const unsigned char *data() const { return data_; }
+    std::size_t size() const { return size_; }
+
+private:
+    const unsigned char *data_;
+    std::size_t size_;
+};
+
+struct record {
+    const ws::capture_record_header *header;
+    const unsigned char *payload;
+};
+
+class client : public std::enable_shared_from_this<client> {
+public:
+    client(boost::asio::io_service &io_service, const tcp::endpoint &endpoint,
+        std::vector<record> records, std::uint64_t t0, double speed,
+        clock_type::time_point start) :
+        socket_(io_service), timer_(io_service), endpoint_(endpoint),
+        records_(std::move(records)), t0_(t0), speed_(speed), start_(start),
+        next_(0), rng_(std::random_device()()) { }
+
+    void start() {
+        auto self(shared_from_this());
+        socket_.async_connect(endpoint_,
+            [this, self](const boost::system::error_code &ec)
+        {
+            if (ec) {
+                std::cerr << "connect: " << ec.message() << "\n";
+                return;
+            }
+            handshake();
+        });
+    }
+
+private:
+    tcp::socket socket_;
+    boost::asio::steady_timer timer_;
+    tcp::endpoint endpoint_;
+    std::vector<record> records_;
+    std::uint64_t t0_;
+    double speed_;
+    clock_type::time_point start_;
+    std::size_t next_;
+    std::mt19937 rng_;
+    std::string request_;
+    boost::asio::streambuf response_;
+    std::vector<unsigned char> frame_;
+    std::array<unsigned char, 4096> discard_;
+
+    void handshake() {
+        request_ =
+            "GET / HTTP/1.1\r\n"
+            "Host: " + endpoint_.address().to_string() + "\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+            "Sec-WebSocket-Version: 13\r\n\r\n";
+
+        auto self(shared_from_this());
+        boost::asio::async_write(socket_, boost::asio::buffer(request_),
+            [this, self](const boost::system::error_code &ec, std::size_t)
+        {
+            if (ec)
+                return;
+
+            boost::asio::async_read_until(socket_, response_, "\r\n\r\n",
+                [this, self](const boost::system::error_code &ec,
+                    std::size_t)
+            {
+                if (ec)
+                    return;
+
+                drain();
+                schedule();
+            });
+        });
+    }
+
+    /* Read and drop whatever the server sends back */
+    void drain() {
+        auto self(shared_from_this());
+        socket_.async_read_some(boost::asio::buffer(discard_),
+            [this, self](const boost::system::error_code &ec, std::size_t)
+        {
+            if (!ec)
+                drain();
+        });
+    }
+
+    void schedule() {
+        if (next_ == records_.size()) {
+            boost::system::error_code ignored;
+            socket_.shutdown(tcp::socket::shutdown_send, ignored);
+            return;
+        }
+
+        std::uint64_t offset = records_[next_].header->timestamp - t0_;
+        timer_.expires_at(start_ + std::chrono::duration_cast<
+            clock_type::duration>(std::chrono::nanoseconds(
+            static_cast<std::uint64_t>(offset / speed_))));
+
+        auto self(shared_from_this());
+        timer_.async_wait([this, self](const boost::system::error_code &ec) {
+            if (!ec)
+                send(records_[next_++]);
+        });
+    }
+
+    void send(const record &r) {
+        auto opcode = static_cast<ws::message::opcode>(r.header->opcode);
+        std::size_t length = r.header->original_length;
+
+        std::array<unsigned char, ws::max_frame_header_length> header;
+        std::size_t header_length = ws::encode_frame_header(opcode, length,
+            header);
+        header[1] |= 0x80;
+
+        std::array<unsigned char, 4> mask;
+        for (auto &m : mask)
+            m = rng_() & 0xff;
+
+        frame_.resize(header_length + mask.size() + length);
+        std::memcpy(frame_.data(), header.data(), header_length);
+        std::memcpy(frame_.data() + header_length, mask.data(), mask.size());
+
+        unsigned char *payload = frame_.data() + header_length + mask.size();
+        if (r.header->flags & ws::capture_flag_hashed)
+            std::memset(payload, 'x', length);
+        else
+            std::memcpy(payload, r.payload, length);
+        for (std::size_t i = 0; i < length; ++i)
+            payload[i] ^= mask[i % 4];
+
+        auto self(shared_from_this());
+        boost::asio::async_write(socket_, boost::asio::buffer(frame_),
+            [this, self](const boost::system::error_code &ec, std::size_t)
+        {
+            if (!ec)
+                schedule();
+        });
+    }
+};
+
+int main(int argc, const char **argv) {
+    if (argc < 4) {
+        std::cerr << "Usage: replay <capture> <host> <port> [speed]\n";
+        return EXIT_FAILURE;
+    }
+
+    try {
+        mapped_file file(argv[1]);
+        double speed = argc > 4 ? std::atof(argv[4]) : 1.0;
+        if (speed <= 0)
+            throw std::runtime_error("speed must be positive");
+
+        const unsigned char *p = file.data();
+        const unsigned char *end = p + file.size();
+        const ws::capture_file_header *file_header =
+            reinterpret_cast<const ws::capture_file_header *>(p);
+        if (file.size() < sizeof (*file_header) ||
+            std::memcmp(file_header->magic, ws::capture_magic,
+                sizeof (ws::capture_magic)) != 0 ||
+            file_header->version != ws::capture_version)
+        {
+            throw std::runtime_error("not a capture file");
+        }
+        p += sizeof (*file_header);
+
+        /* Group records by session, keeping their order */
+        std::map<std::uint64_t, std::vector<record>> sessions;
+        std::uint64_t t0 = 0;
+        std::size_t count = 0;
+        while (end - p >= static_cast<std::ptrdiff_t>(
+            sizeof (ws::capture_record_header)))
+        {
+            const ws::capture_record_header *header =
+                reinterpret_cast<const ws::capture_record_header *>(p);
+            std::size_t padded = (header->length + 7) & ~std::size_t(7);
+            if (static_cast<std::size_t>(end - p) < sizeof (*header) + padded)
+                break;
+
+            sessions[header->session_id].push_back(
+                record{header, p + sizeof (*header)});
+            if (!count++ || header->timestamp < t0)
+                t0 = header->timestamp;
+            p += sizeof (*header) + padded;
+        }
+
+        std::cout << "Replaying " << count << " frames from "
+            << sessions.size() << " sessions at " << speed << "x\n";
+
+        boost::asio::io_service io_service;
+        tcp::resolver resolver(io_service);
+        tcp::endpoint endpoint = *resolver.resolve(argv[2], argv[3]).begin();
+
+        auto start = clock_type::now();
+        for (auto &s : sessions) {
+            std::make_shared<client>(io_service, endpoint,
+                std::move(s.second), t0, speed, start)->start();
+        }
+        io_service.run();
+
+        std::cout << "Done in " << std::chrono::duration_cast<
+            std::chrono::milliseconds>(clock_type::now() - start).count()
+            << " ms\n";
+    } catch (std::exception &e) {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,32 @@
+#!/bin/sh
+# Hot restart under load: starts chat_server, runs restart_load against it
+# and starts a new chat_server every two seconds, each taking over from the
+# previous one. Build ../chat and this directory first. Exits non-zero if
+# any connect was refused or any session failed.
+
+set -e
+cd "$(dirname "$0")"
+
+SECONDS_OF_LOAD=${1:-10}
+THREADS=${2:-4}
+
+../chat/chat_server > /dev/null &
+server=$!
+sleep 1
+
+./restart_load 127.0.0.1 4567 "$SECONDS_OF_LOAD" "$THREADS" &
+load=$!
+
+elapsed=2
+while [ "$elapsed" -lt "$SECONDS_OF_LOAD" ]; do
+    sleep 2
+    ../chat/chat_server > /dev/null &
+    server=$!
+    elapsed=$((elapsed + 2))
+done
+
+status=0
+wait "$load" || status=$?
+kill "$server"
+rm -f chat_server.sock
+exit "$status"
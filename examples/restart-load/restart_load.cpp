@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include "ws/frame.hpp"
+
+/* Connection load for hot restart tests: threads connecting, completing the
+ * opening and closing handshakes and reconnecting, as fast as they can, for
+ * a number of seconds:
+ *
+ *     restart_load <host> <port> <seconds> [threads]
+ *
+ * Every attempt is counted as completed, refused (connect failed) or failed
+ * (the handshakes didn't complete), together with the slowest connect.
+ * restart.sh restarts chat_server under this load; a clean handoff shows no
+ * refused or failed attempts. */
+
+using boost::asio::ip::tcp;
+typedef std::chrono::steady_clock clock_type;
+
+std::atomic<std::size_t> completed(0);
+std::atomic<std::size_t> refused(0);
+std::atomic<std::size_t> failed(0);
+
+/* Opening handshake, then a close frame and the server's close frame */
+void session(tcp::socket &socket) {
+    const std::string request =
+        "GET / HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+        "Sec-WebSocket-Version: 13\r\n\r\n";
+    boost::asio::write(socket, boost::asio::buffer(request));
+
+    boost::asio::streambuf response;
+    boost::asio::read_until(socket, response, "\r\n\r\n");
+    std::string status(boost::asio::buffers_begin(response.data()),
+        boost::asio::buffers_begin(response.data()) + 12);
+    if (status != "HTTP/1.1 101")
+        throw std::runtime_error("handshake refused");
+
+    /* Masked close frame without a payload */
+    const std::array<unsigned char, 6> close = {{ 0x88, 0x80, 0, 0, 0, 0 }};
+    boost::asio::write(socket, boost::asio::buffer(close));
+
+    /* Whatever the server still sends, up to its close */
+    boost::system::error_code ec;
+    std::array<unsigned char, 4096> discard;
+    while (!ec)
+        socket.read_some(boost::asio::buffer(discard), ec);
+    if (ec != boost::asio::error::eof &&
+        ec != boost::asio::error::connection_reset)
+    {
+        throw boost::system::system_error(ec);
+    }
+}
+
+void run(const tcp::endpoint &endpoint, clock_type::time_point deadline,
+    double &slowest_connect)
+{
+    boost::asio::io_service io_service;
+    while (clock_type::now() < deadline) {
+        tcp::socket socket(io_service);
+        boost::system::error_code ec;
+        auto start = clock_type::now();
+        socket.connect(endpoint, ec);
+        slowest_connect = std::max(slowest_connect,
+            std::chrono::duration<double, std::milli>(
+                clock_type::now() - start).count());
+        if (ec) {
+            ++refused;
+            continue;
+        }
+
+        try {
+            session(socket);
+            ++completed;
+        } catch (std::exception &) {
+            ++failed;
+        }
+    }
+}
+
+int main(int argc, const char **argv) {
+    if (argc < 4) {
+        std::cerr << "Usage: restart_load <host> <port> <seconds> "
+            "[threads]\n";
+        return EXIT_FAILURE;
+    }
+    std::size_t threads = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 4;
+    if (!threads) {
+        std::cerr << "threads must be positive\n";
+        return EXIT_FAILURE;
+    }
+
+    try {
+        boost::asio::io_service io_service;
+        tcp::resolver resolver(io_service);
+        tcp::endpoint endpoint = *resolver.resolve(argv[1], argv[2]);
+        auto deadline = clock_type::now() +
+            std::chrono::seconds(std::strtoul(argv[3], nullptr, 10));
+
+        std::vector<double> slowest(threads, 0);
+        std::vector<std::thread> workers;
+        for (std::size_t i = 0; i < threads; ++i)
+            workers.emplace_back(run, std::cref(endpoint), deadline,
+                std::ref(slowest[i]));
+        for (auto &w : workers)
+            w.join();
+
+        std::cout << completed << " completed, " << refused << " refused, "
+            << failed << " failed, slowest connect "
+            << *std::max_element(slowest.begin(), slowest.end()) << " ms\n";
+        return refused || failed ? EXIT_FAILURE : EXIT_SUCCESS;
+    } catch (std::exception &e) {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,203 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include "ws.hpp"
+#include "ws/worker_pool.hpp"
+
+/* Fast handlers next to slow ones: an echo server with one io thread, where
+ * messages starting with 's' take a blocking 5 ms to handle (a database
+ * call, say) and all others are echoed at once. Slow clients keep sending
+ * slow messages while a fast client sends a fast one every millisecond and
+ * times the echo:
+ *
+ *     slow_handlers [samples] [slow clients] [workers]
+ *
+ * Measured with handlers run on the io thread, then on a ws::worker_pool of
+ * workers threads (default 8). */
+
+using boost::asio::ip::tcp;
+typedef std::chrono::steady_clock clock_type;
+
+class session_base {
+public:
+    session_base(tcp::socket socket) : socket_(std::move(socket)) { }
+protected:
+    tcp::socket socket_;
+};
+
+using T = tcp::socket;
+class session : public session_base, public ws::session<T> {
+public:
+    session(tcp::socket socket, ws::worker_pool *pool) :
+        session_base(std::move(socket)), ws::session<T>(socket_),
+        pool_(pool) { }
+
+private:
+    ws::worker_pool *pool_;
+
+    void on_open() override {
+        if (pool_)
+            set_worker_pool(*pool_);
+    }
+
+    void on_msg(const ws::message &msg) override {
+        const ws::payload &payload = msg.get_payload();
+        if (!payload.empty() && payload[0] == 's')
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+        write(msg.get_opcode(),
+            boost::asio::buffer(payload.data(), payload.size()), [this]()
+        {
+            read();
+        });
+    }
+
+    void on_close() override { }
+    void on_error() override { }
+};
+
+/* Echo server on its own io thread */
+class server {
+public:
+    explicit server(std::size_t workers) :
+        pool_(workers ? new ws::worker_pool(workers) : nullptr),
+        acceptor_(io_service_,
+            tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0),
+            [this](tcp::socket socket) {
+                socket.set_option(tcp::no_delay(true));
+                std::make_shared<session>(std::move(socket), pool_.get())
+                    ->start();
+            }),
+        thread_([this]() { io_service_.run(); }) { }
+
+    ~server() {
+        io_service_.stop();
+        thread_.join();
+    }
+
+    tcp::endpoint endpoint() const {
+        return acceptor_.local_endpoint();
+    }
+
+private:
+    boost::asio::io_service io_service_;
+    /* Destroyed before io_service_, which its workers may still post to */
+    std::unique_ptr<ws::worker_pool> pool_;
+    ws::acceptor acceptor_;
+    std::thread thread_;
+};
+
+void connect(tcp::socket &socket, const tcp::endpoint &endpoint) {
+    socket.connect(endpoint);
+    socket.set_option(tcp::no_delay(true));
+
+    const std::string request =
+        "GET / HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+        "Sec-WebSocket-Version: 13\r\n\r\n";
+    boost::asio::write(socket, boost::asio::buffer(request));
+
+    /* The server sends nothing after its response until we do */
+    boost::asio::streambuf response;
+    boost::asio::read_until(socket, response, "\r\n\r\n");
+}
+
+/* Masked 16 byte client frame, filled with c */
+std::array<unsigned char, 22> client_frame(char c) {
+    std::array<unsigned char, 22> frame;
+    frame.fill(c);
+    frame[0] = 0x82;
+    frame[1] = 0x80 | 16;
+    frame[2] = frame[3] = frame[4] = frame[5] = 0;
+    return frame;
+}
+
+void run(const std::string &name, std::size_t samples, std::size_t slow,
+    std::size_t workers)
+{
+    server s(workers);
+    tcp::endpoint endpoint = s.endpoint();
+
+    /* Slow clients, one message at a time until told to stop */
+    std::atomic<bool> stop(false);
+    std::atomic<std::size_t> slow_echoes(0);
+    std::vector<std::thread> slow_clients;
+    for (std::size_t i = 0; i < slow; ++i) {
+        slow_clients.emplace_back([&]() {
+            boost::asio::io_service io_service;
+            tcp::socket socket(io_service);
+            connect(socket, endpoint);
+            auto frame = client_frame('s');
+            std::array<unsigned char, 18> echo;
+            while (!stop) {
+                boost::asio::write(socket, boost::asio::buffer(frame));
+                boost::asio::read(socket, boost::asio::buffer(echo));
+                ++slow_echoes;
+            }
+        });
+    }
+
+    boost::asio::io_service io_service;
+    tcp::socket socket(io_service);
+    connect(socket, endpoint);
+    auto frame = client_frame('f');
+    std::array<unsigned char, 18> echo;
+    std::vector<double> latencies;
+    latencies.reserve(samples);
+
+    auto start = clock_type::now();
+    auto next = start;
+    for (std::size_t i = 0; i < samples; ++i) {
+        next += std::chrono::milliseconds(1);
+        std::this_thread::sleep_until(next);
+
+        auto sent = clock_type::now();
+        boost::asio::write(socket, boost::asio::buffer(frame));
+        boost::asio::read(socket, boost::asio::buffer(echo));
+        latencies.push_back(std::chrono::duration<double, std::milli>(
+            clock_type::now() - sent).count());
+    }
+    double seconds = std::chrono::duration<double>(
+        clock_type::now() - start).count();
+
+    stop = true;
+    for (auto &c : slow_clients)
+        c.join();
+
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << name << ": fast p50 " << latencies[samples / 2]
+        << " ms, p99 " << latencies[samples * 99 / 100] << " ms, slow "
+        << static_cast<std::size_t>(slow_echoes / seconds) << " msg/s\n";
+}
+
+int main(int argc, const char **argv) {
+    std::size_t samples = argc > 1 ? std::strtoul(argv[1], nullptr, 10) :
+        1000;
+    std::size_t slow = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4;
+    std::size_t workers = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 8;
+    if (!samples || !workers) {
+        std::cerr << "samples and workers must be positive\n";
+        return EXIT_FAILURE;
+    }
+
+    try {
+        run("io thread", samples, slow, 0);
+        run("worker pool", samples, slow, workers);
+    } catch (std::exception &e) {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,307 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <boost/asio.hpp>
+#include "ws.hpp"
+
+/* Handshake latency next to slowloris clients: an echo server runs on its
+ * own io thread while slow connections from 127.0.0.2 each send the start of
+ * a request and then one more header byte a second, reconnecting whenever
+ * the server drops them, and a healthy client on 127.0.0.1 connects every
+ * 10 ms and times its handshake:
+ *
+ *     slowloris [slow connections] [samples] [limit] [per address]
+ *
+ * Measured with no slow connections, with them, with them while the server
+ * shares a ws::handshake_limiter of limit handshakes (default 512) between
+ * its sessions, and with the limiter also capping each address at per
+ * address handshakes (default 64). Sessions over a cap are answered 503.
+ * Both ends hold a descriptor per connection, so the open file limit must be
+ * above twice the slow connections plus a few. */
+
+using boost::asio::ip::tcp;
+typedef std::chrono::steady_clock clock_type;
+
+class session_base {
+public:
+    session_base(tcp::socket socket) : socket_(std::move(socket)) { }
+protected:
+    tcp::socket socket_;
+};
+
+using T = tcp::socket;
+class session : public session_base, public ws::session<T> {
+public:
+    session(tcp::socket socket, ws::handshake_limiter *limiter) :
+        session_base(std::move(socket)), ws::session<T>(socket_)
+    {
+        if (limiter)
+            set_handshake_limiter(*limiter);
+    }
+
+private:
+    void on_open() override { }
+
+    void on_msg(const ws::message &msg) override {
+        const ws::payload &payload = msg.get_payload();
+        write(msg.get_opcode(),
+            boost::asio::buffer(payload.data(), payload.size()), [this]()
+        {
+            read();
+        });
+    }
+
+    void on_close() override { }
+    void on_error() override { }
+};
+
+/* Echo server on its own io thread */
+class server {
+public:
+    server(std::size_t limit, std::size_t per_address) :
+        limiter_(limit ? new ws::handshake_limiter(limit, per_address) :
+            nullptr),
+        acceptor_(io_service_,
+            tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0),
+            [this](tcp::socket socket) {
+                std::make_shared<session>(std::move(socket), limiter_.get())
+                    ->start();
+            }),
+        thread_([this]() { io_service_.run(); }) { }
+
+    ~server() {
+        io_service_.stop();
+        thread_.join();
+    }
+
+    tcp::endpoint endpoint() const {
+        return acceptor_.local_endpoint();
+    }
+
+private:
+    std::unique_ptr<ws::handshake_limiter> limiter_;
+    boost::asio::io_service io_service_;
+    ws::acceptor acceptor_;
+    std::thread thread_;
+};
+
+/* Keeps connections trickling their requests from one thread, replacing
+ * any the server drops */
+class slow_clients {
+public:
+    slow_clients(const tcp::endpoint &endpoint, std::size_t count) :
+        endpoint_(endpoint), connected_(0), dropped_(0)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+            connections_.emplace_back(new connection(*this));
+        for (auto &c : connections_)
+            c->start();
+        thread_ = std::thread([this]() { io_service_.run(); });
+    }
+
+    ~slow_clients() {
+        io_service_.stop();
+        thread_.join();
+    }
+
+    /* Connections that have sent the start of their request */
+    std::size_t connected() const {
+        return connected_;
+    }
+
+    /* Connections the server has closed */
+    std::size_t dropped() const {
+        return dropped_;
+    }
+
+private:
+    class connection {
+    public:
+        explicit connection(slow_clients &owner) :
+            owner_(owner), socket_(owner.io_service_),
+            timer_(owner.io_service_) { }
+
+        void start() {
+            boost::system::error_code ec;
+            socket_.close(ec);
+            socket_.open(tcp::v4(), ec);
+            if (!ec)
+                socket_.bind(tcp::endpoint(
+                    boost::asio::ip::address_v4::from_string("127.0.0.2"), 0),
+                    ec);
+            if (ec) {
+                retry();
+                return;
+            }
+            socket_.async_connect(owner_.endpoint_,
+                [this](const boost::system::error_code &ec)
+            {
+                if (ec) {
+                    retry();
+                    return;
+                }
+
+                static const std::string start =
+                    "GET / HTTP/1.1\r\n"
+                    "Host: localhost\r\n"
+                    "X-Slow: ";
+                boost::asio::async_write(socket_, boost::asio::buffer(start),
+                    [this](const boost::system::error_code &ec, std::size_t)
+                {
+                    if (ec) {
+                        dropped();
+                        return;
+                    }
+                    ++owner_.connected_;
+                    wait();
+                });
+            });
+        }
+
+    private:
+        slow_clients &owner_;
+        tcp::socket socket_;
+        boost::asio::steady_timer timer_;
+
+        void wait() {
+            timer_.expires_after(std::chrono::seconds(1));
+            timer_.async_wait([this](const boost::system::error_code &ec) {
+                if (ec)
+                    return;
+
+                static const char byte = 'x';
+                boost::asio::async_write(socket_,
+                    boost::asio::buffer(&byte, 1),
+                    [this](const boost::system::error_code &ec, std::size_t)
+                {
+                    if (ec) {
+                        --owner_.connected_;
+                        dropped();
+                    } else {
+                        wait();
+                    }
+                });
+            });
+        }
+
+        void dropped() {
+            ++owner_.dropped_;
+            start();
+        }
+
+        void retry() {
+            timer_.expires_after(std::chrono::milliseconds(100));
+            timer_.async_wait([this](const boost::system::error_code &ec) {
+                if (!ec)
+                    start();
+            });
+        }
+    };
+
+    boost::asio::io_service io_service_;
+    tcp::endpoint endpoint_;
+    std::vector<std::unique_ptr<connection>> connections_;
+    std::atomic<std::size_t> connected_;
+    std::atomic<std::size_t> dropped_;
+    std::thread thread_;
+};
+
+void run(const std::string &name, std::size_t slow, std::size_t samples,
+    std::size_t limit, std::size_t per_address)
+{
+    server s(limit, per_address);
+    std::unique_ptr<slow_clients> loris;
+    if (slow) {
+        loris.reset(new slow_clients(s.endpoint(), slow));
+        while (loris->connected() < slow)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    const std::string request =
+        "GET / HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+        "Sec-WebSocket-Version: 13\r\n\r\n";
+
+    boost::asio::io_service io_service;
+    std::vector<double> latencies;
+    std::size_t rejected = 0;
+    auto next = clock_type::now();
+    for (std::size_t i = 0; i < samples; ++i) {
+        next += std::chrono::milliseconds(10);
+        std::this_thread::sleep_until(next);
+
+        auto start = clock_type::now();
+        tcp::socket socket(io_service);
+        socket.connect(s.endpoint());
+        boost::asio::write(socket, boost::asio::buffer(request));
+        boost::asio::streambuf response;
+        boost::system::error_code ec;
+        boost::asio::read_until(socket, response, "\r\n\r\n", ec);
+        double ms = std::chrono::duration<double, std::milli>(
+            clock_type::now() - start).count();
+
+        std::string status;
+        std::istream(&response) >> status >> status;
+        if (ec || status != "101")
+            ++rejected;
+        else
+            latencies.push_back(ms);
+    }
+
+    std::cout << name << ": ";
+    if (!latencies.empty()) {
+        std::sort(latencies.begin(), latencies.end());
+        std::cout << "handshake p50 " << latencies[latencies.size() / 2]
+            << " ms, p99 " << latencies[latencies.size() * 99 / 100]
+            << " ms, ";
+    }
+    std::cout << rejected << " of " << samples << " rejected";
+    if (slow)
+        std::cout << ", " << loris->dropped() << " slow connections dropped";
+    std::cout << "\n";
+}
+
+int main(int argc, const char **argv) {
+    std::size_t slow = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000;
+    std::size_t samples = argc > 2 ? std::strtoul(argv[2], nullptr, 10) :
+        500;
+    std::size_t limit = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 512;
+    std::size_t per_address = argc > 4 ?
+        std::strtoul(argv[4], nullptr, 10) : 64;
+    if (!slow || !samples || !limit || !per_address) {
+        std::cerr << "slow connections, samples, limit and per address must "
+            "be positive\n";
+        return EXIT_FAILURE;
+    }
+
+    rlimit rl;
+    if (::getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    try {
+        std::string name = std::to_string(slow) + " slow";
+        run("alone", 0, samples, 0, 0);
+        run(name, slow, samples, 0, 0);
+        name += ", limit " + std::to_string(limit);
+        run(name, slow, samples, limit, 0);
+        run(name + ", " + std::to_string(per_address) + " per address", slow,
+            samples, limit, per_address);
+    } catch (std::exception &e) {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
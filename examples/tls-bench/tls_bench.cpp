@@ -0,0 +1,363 @@
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include "ws.hpp"
+#include "ws/tls.hpp"
+
+/* TLS costs of a session over loopback, server and client in one process:
+ *
+ *     tls_bench [handshakes] [frames] [size]
+ *
+ * First the rate of full and of resumed handshakes (TLS plus WebSocket
+ * upgrade) against a context set up by ws::tls::configure_server, then the
+ * TLS records the client receives for a burst of frames written back to
+ * back (queued, so coalesced into shared records) and for the same frames
+ * written one at a time. The server certificate is a throwaway P-256 one
+ * generated at startup. */
+
+using boost::asio::ip::tcp;
+typedef std::chrono::steady_clock clock_type;
+
+/* Self-signed certificate and key for localhost */
+void use_throwaway_certificate(boost::asio::ssl::context &context) {
+    EVP_PKEY *key = nullptr;
+    EVP_PKEY_CTX *key_ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+    if (!key_ctx || EVP_PKEY_keygen_init(key_ctx) != 1 ||
+        EVP_PKEY_CTX_set_ec_paramgen_curve_nid(key_ctx,
+            NID_X9_62_prime256v1) != 1 ||
+        EVP_PKEY_keygen(key_ctx, &key) != 1)
+    {
+        throw std::runtime_error("unable to generate key");
+    }
+    EVP_PKEY_CTX_free(key_ctx);
+
+    X509 *cert = X509_new();
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 3600);
+    X509_set_pubkey(cert, key);
+    X509_NAME *name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+        reinterpret_cast<const unsigned char *>("localhost"), -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    if (!X509_sign(cert, key, EVP_sha256()) ||
+        SSL_CTX_use_certificate(context.native_handle(), cert) != 1 ||
+        SSL_CTX_use_PrivateKey(context.native_handle(), key) != 1)
+    {
+        throw std::runtime_error("unable to create certificate");
+    }
+    X509_free(cert);
+    EVP_PKEY_free(key);
+}
+
+class session_base {
+public:
+    session_base(tcp::socket socket, boost::asio::ssl::context &context) :
+        socket_(std::move(socket)), ssl_socket_(socket_, context) { }
+protected:
+    tcp::socket socket_;
+    boost::asio::ssl::stream<tcp::socket&> ssl_socket_;
+};
+
+/* Answers "burst <count> <size>" and "serial <count> <size>" with count
+ * binary messages of size bytes */
+using T = boost::asio::ssl::stream<tcp::socket&>;
+class session : public session_base, public ws::session<T> {
+public:
+    session(tcp::socket socket, boost::asio::ssl::context &context) :
+        session_base(std::move(socket), context), ws::session<T>(ssl_socket_)
+    { }
+
+    void start() {
+        auto self(shared_from_this());
+        ssl_socket_.async_handshake(boost::asio::ssl::stream_base::server,
+            [this, self](const boost::system::error_code &ec)
+        {
+            if (!ec)
+                ws::session<T>::start();
+        });
+    }
+
+private:
+    std::vector<unsigned char> payload_;
+
+    void on_open() override { }
+
+    void on_msg(const ws::message &msg) override {
+        const ws::payload &payload = msg.get_payload();
+        std::istringstream command(std::string(payload.begin(),
+            payload.end()));
+        std::string mode;
+        std::size_t count = 0;
+        std::size_t size = 0;
+        command >> mode >> count >> size;
+        payload_.assign(size, 'x');
+
+        if (mode == "burst") {
+            for (std::size_t i = 0; i < count; ++i)
+                write(ws::message::opcode::binary,
+                    boost::asio::buffer(payload_), nullptr);
+        } else if (mode == "serial") {
+            write_serial(count);
+        }
+        read();
+    }
+
+    void write_serial(std::size_t remaining) {
+        if (!remaining)
+            return;
+
+        write(ws::message::opcode::binary, boost::asio::buffer(payload_),
+            [this, remaining]()
+        {
+            write_serial(remaining - 1);
+        });
+    }
+
+    void on_close() override { }
+    void on_error() override { }
+};
+
+class server {
+public:
+    server(boost::asio::io_service &io_service) :
+        acceptor_(io_service, tcp::endpoint(
+            boost::asio::ip::address_v4::loopback(), 0)),
+        socket_(io_service), context_(boost::asio::ssl::context::tls_server)
+    {
+        use_throwaway_certificate(context_);
+        ws::tls::configure_server(context_);
+        accept();
+    }
+
+    unsigned short port() const {
+        return acceptor_.local_endpoint().port();
+    }
+
+private:
+    tcp::acceptor acceptor_;
+    tcp::socket socket_;
+    boost::asio::ssl::context context_;
+
+    void accept() {
+        acceptor_.async_accept(socket_,
+            [this](const boost::system::error_code &ec)
+        {
+            if (!ec) {
+                socket_.set_option(tcp::no_delay(true));
+                std::make_shared<session>(std::move(socket_), context_)
+                    ->start();
+            }
+
+            accept();
+        });
+    }
+};
+
+/* Client side: the last session ticket received, and the records received
+ * since the counters were reset */
+SSL_SESSION *ticket = nullptr;
+std::size_t records = 0;
+std::size_t record_bytes = 0;
+
+int new_session(SSL *, SSL_SESSION *session) {
+    if (ticket)
+        SSL_SESSION_free(ticket);
+    ticket = session;
+    return 1;
+}
+
+void count_records(int write_p, int, int content_type, const void *buf,
+    std::size_t len, SSL *, void *)
+{
+    const unsigned char *header = static_cast<const unsigned char *>(buf);
+    if (!write_p && content_type == SSL3_RT_HEADER && len >= 5) {
+        ++records;
+        record_bytes += 5 + (header[3] << 8 | header[4]);
+    }
+}
+
+typedef boost::asio::ssl::stream<tcp::socket> client_stream;
+
+void upgrade(client_stream &stream) {
+    const std::string request =
+        "GET / HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+        "Sec-WebSocket-Version: 13\r\n\r\n";
+    boost::asio::write(stream, boost::asio::buffer(request));
+
+    /* The server sends nothing after its response until we do */
+    boost::asio::streambuf response;
+    boost::asio::read_until(stream, response, "\r\n\r\n");
+}
+
+/* Masked client frame */
+std::vector<unsigned char> client_frame(ws::message::opcode opcode,
+    const std::string &payload)
+{
+    std::array<unsigned char, ws::max_frame_header_length> header;
+    std::size_t header_length = ws::encode_frame_header(opcode,
+        payload.size(), header);
+    header[1] |= 0x80;
+
+    const std::array<unsigned char, 4> mask = {{ 0x12, 0x34, 0x56, 0x78 }};
+    std::vector<unsigned char> frame(header.begin(),
+        header.begin() + header_length);
+    frame.insert(frame.end(), mask.begin(), mask.end());
+    for (std::size_t i = 0; i < payload.size(); ++i)
+        frame.push_back(payload[i] ^ mask[i % 4]);
+    return frame;
+}
+
+/* Read one unmasked server frame, returning its payload length */
+std::size_t read_frame(client_stream &stream,
+    std::vector<unsigned char> &payload)
+{
+    std::array<unsigned char, 8> header;
+    boost::asio::read(stream, boost::asio::buffer(header.data(), 2));
+
+    std::size_t length = header[1] & 0x7f;
+    if (length == 126) {
+        boost::asio::read(stream, boost::asio::buffer(header.data(), 2));
+        length = header[0] << 8 | header[1];
+    } else if (length == 127) {
+        boost::asio::read(stream, boost::asio::buffer(header.data(), 8));
+        length = 0;
+        for (std::size_t i = 0; i < 8; ++i)
+            length = length << 8 | header[i];
+    }
+
+    payload.resize(length);
+    boost::asio::read(stream, boost::asio::buffer(payload));
+    return length;
+}
+
+/* Closing handshake then close_notify, without which OpenSSL drops the
+ * session from the cache */
+void close(client_stream &stream) {
+    std::vector<unsigned char> frame = client_frame(
+        ws::message::opcode::connection_close, std::string());
+    boost::asio::write(stream, boost::asio::buffer(frame));
+    std::vector<unsigned char> reply;
+    read_frame(stream, reply);
+
+    boost::system::error_code ignored;
+    stream.shutdown(ignored);
+    stream.lowest_layer().close();
+}
+
+void handshakes(boost::asio::io_service &io_service,
+    boost::asio::ssl::context &context, const tcp::endpoint &endpoint,
+    std::size_t count, bool resume)
+{
+    std::size_t resumed = 0;
+    auto start = clock_type::now();
+    for (std::size_t i = 0; i < count; ++i) {
+        client_stream stream(io_service, context);
+        if (resume && ticket)
+            SSL_set_session(stream.native_handle(), ticket);
+        stream.lowest_layer().connect(endpoint);
+        stream.lowest_layer().set_option(tcp::no_delay(true));
+        stream.handshake(boost::asio::ssl::stream_base::client);
+        /* Tickets arrive after the handshake, with the first read */
+        upgrade(stream);
+        if (SSL_session_reused(stream.native_handle()))
+            ++resumed;
+        close(stream);
+    }
+    double seconds = std::chrono::duration<double>(
+        clock_type::now() - start).count();
+
+    std::cout << (resume ? "resumed" : "full") << " handshakes: " << count
+        << " (" << resumed << " resumed), "
+        << static_cast<std::size_t>(count / seconds) << "/s\n";
+}
+
+void records_per_frame(client_stream &stream, const std::string &mode,
+    std::size_t count, std::size_t size)
+{
+    std::ostringstream command;
+    command << mode << " " << count << " " << size;
+    std::vector<unsigned char> frame = client_frame(
+        ws::message::opcode::text, command.str());
+
+    records = 0;
+    record_bytes = 0;
+    boost::asio::write(stream, boost::asio::buffer(frame));
+    std::vector<unsigned char> payload;
+    std::size_t frame_bytes = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        std::size_t length = read_frame(stream, payload);
+        frame_bytes += length + (length < 126 ? 2 : length < 65536 ? 4 : 10);
+    }
+
+    std::cout << mode << ": " << count << " frames of " << size << " bytes, "
+        << records << " records, " << double(records) / count
+        << " records/frame, " << double(record_bytes) / count
+        << " bytes/frame on the wire for " << double(frame_bytes) / count
+        << " bytes/frame of WebSocket\n";
+}
+
+int main(int argc, const char **argv) {
+    std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000;
+    std::size_t frames = argc > 2 ? std::strtoul(argv[2], nullptr, 10) :
+        10000;
+    std::size_t size = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 32;
+    if (!count || !frames) {
+        std::cerr << "handshakes and frames must be positive\n";
+        return EXIT_FAILURE;
+    }
+
+    try {
+        boost::asio::io_service server_io_service;
+        server s(server_io_service);
+        tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(),
+            s.port());
+        std::thread server_thread([&server_io_service]() {
+            server_io_service.run();
+        });
+
+        boost::asio::io_service io_service;
+        boost::asio::ssl::context context(
+            boost::asio::ssl::context::tls_client);
+        SSL_CTX_set_session_cache_mode(context.native_handle(),
+            SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(context.native_handle(), new_session);
+        SSL_CTX_set_msg_callback(context.native_handle(), count_records);
+
+        handshakes(io_service, context, endpoint, count, false);
+        handshakes(io_service, context, endpoint, count, true);
+
+        client_stream stream(io_service, context);
+        stream.lowest_layer().connect(endpoint);
+        stream.lowest_layer().set_option(tcp::no_delay(true));
+        stream.handshake(boost::asio::ssl::stream_base::client);
+        upgrade(stream);
+        records_per_frame(stream, "burst", frames, size);
+        records_per_frame(stream, "serial", frames, size);
+        close(stream);
+
+        server_io_service.stop();
+        server_thread.join();
+    } catch (std::exception &e) {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,258 @@
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <sys/resource.h>
+#include <boost/asio.hpp>
+#include "ws.hpp"
+#include "ws/uring.hpp"
+
+/* A/B of the epoll and io_uring transports: an echo server runs on its own
+ * io thread with sessions over tcp::socket (Asio's epoll reactor) and then
+ * over ws::uring_stream, while a client thread keeps one small message in
+ * flight on each of its connections:
+ *
+ *     uring_bench [connections] [messages] [size]
+ *
+ * Reports messages per second and, for the server's io thread alone, CPU
+ * time per message and context switches; the io_uring run also counts its
+ * io_uring_enter() calls. Both ends hold a descriptor per connection, so the
+ * open file limit must be above twice the connections plus a few. */
+
+using boost::asio::ip::tcp;
+typedef std::chrono::steady_clock clock_type;
+
+template <typename Stream>
+class stream_base {
+public:
+    template <typename... Args>
+    explicit stream_base(Args &&... args) :
+        stream_(std::forward<Args>(args)...) { }
+protected:
+    Stream stream_;
+};
+
+template <typename Stream>
+class session : public stream_base<Stream>, public ws::session<Stream> {
+public:
+    template <typename... Args>
+    explicit session(Args &&... args) :
+        stream_base<Stream>(std::forward<Args>(args)...),
+        ws::session<Stream>(this->stream_) { }
+
+private:
+    void on_open() override { }
+
+    void on_msg(const ws::message &msg) override {
+        const ws::payload &payload = msg.get_payload();
+        this->write(msg.get_opcode(),
+            boost::asio::buffer(payload.data(), payload.size()), [this]()
+        {
+            this->read();
+        });
+    }
+
+    void on_close() override { }
+    void on_error() override { }
+};
+
+/* What the calling thread has used so far */
+struct thread_usage {
+    double cpu_seconds;
+    double system_seconds;
+    long context_switches;
+    std::size_t enters;
+};
+
+thread_usage this_thread_usage() {
+    rusage ru;
+    ::getrusage(RUSAGE_THREAD, &ru);
+    thread_usage u;
+    u.system_seconds = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    u.cpu_seconds = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+        u.system_seconds;
+    u.context_switches = ru.ru_nvcsw + ru.ru_nivcsw;
+    u.enters = 0;
+    return u;
+}
+
+/* Echo server on its own io thread */
+class server {
+public:
+    explicit server(bool uring) :
+        ring_(uring ? new ws::uring(io_service_) : nullptr),
+        acceptor_(io_service_,
+            tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0),
+            [this](tcp::socket socket) {
+                if (ring_) {
+                    std::make_shared<session<ws::uring_stream>>(*ring_,
+                        std::move(socket))->start();
+                } else {
+                    std::make_shared<session<tcp::socket>>(
+                        std::move(socket))->start();
+                }
+            }),
+        thread_([this]() { io_service_.run(); }) { }
+
+    ~server() {
+        io_service_.stop();
+        thread_.join();
+    }
+
+    tcp::endpoint endpoint() const {
+        return acceptor_.local_endpoint();
+    }
+
+    /* The io thread's usage so far, taken on it */
+    thread_usage usage() {
+        std::promise<thread_usage> result;
+        boost::asio::post(io_service_, [this, &result]() {
+            thread_usage u = this_thread_usage();
+            if (ring_)
+                u.enters = ring_->enters();
+            result.set_value(u);
+        });
+        return result.get_future().get();
+    }
+
+private:
+    boost::asio::io_service io_service_;
+    std::unique_ptr<ws::uring> ring_;
+    ws::acceptor acceptor_;
+    std::thread thread_;
+};
+
+/* A client connection sending the next message once the echo is back */
+class connection {
+public:
+    connection(boost::asio::io_service &io_service,
+        const std::vector<unsigned char> &frame, std::size_t reply_size,
+        std::size_t &remaining) :
+        socket_(io_service), frame_(frame), reply_(reply_size),
+        remaining_(remaining) { }
+
+    void handshake(const tcp::endpoint &endpoint) {
+        const std::string request =
+            "GET / HTTP/1.1\r\n"
+            "Host: localhost\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+            "Sec-WebSocket-Version: 13\r\n\r\n";
+        socket_.connect(endpoint);
+        socket_.set_option(tcp::no_delay(true));
+        boost::asio::write(socket_, boost::asio::buffer(request));
+
+        /* The server sends nothing after its response until we do */
+        boost::asio::streambuf response;
+        boost::asio::read_until(socket_, response, "\r\n\r\n");
+    }
+
+    void send() {
+        if (!remaining_)
+            return;
+        --remaining_;
+
+        boost::asio::async_write(socket_, boost::asio::buffer(frame_),
+            [this](const boost::system::error_code &ec, std::size_t)
+        {
+            if (ec)
+                return;
+            boost::asio::async_read(socket_, boost::asio::buffer(reply_),
+                [this](const boost::system::error_code &ec, std::size_t)
+            {
+                if (!ec)
+                    send();
+            });
+        });
+    }
+
+private:
+    tcp::socket socket_;
+    const std::vector<unsigned char> &frame_;
+    std::vector<unsigned char> reply_;
+    std::size_t &remaining_;
+};
+
+void run(const std::string &name, bool uring, std::size_t connections,
+    std::size_t messages, std::size_t size)
+{
+    server s(uring);
+
+    /* Masked client frame with mask 0, echoed back unmasked */
+    std::array<unsigned char, ws::max_frame_header_length> header;
+    std::size_t header_length = ws::encode_frame_header(
+        ws::message::opcode::binary, size, header);
+    header[1] |= 0x80;
+    std::vector<unsigned char> frame(header.begin(),
+        header.begin() + header_length);
+    frame.insert(frame.end(), 4, 0);
+    frame.insert(frame.end(), size, 'x');
+    std::size_t reply_size = header_length + size;
+
+    boost::asio::io_service io_service;
+    std::size_t remaining = messages;
+    std::vector<std::unique_ptr<connection>> c;
+    for (std::size_t i = 0; i < connections; ++i) {
+        c.emplace_back(new connection(io_service, frame, reply_size,
+            remaining));
+        c.back()->handshake(s.endpoint());
+    }
+
+    thread_usage before = s.usage();
+    auto start = clock_type::now();
+    for (auto &conn : c)
+        conn->send();
+    io_service.run();
+    double seconds = std::chrono::duration<double>(
+        clock_type::now() - start).count();
+    thread_usage after = s.usage();
+
+    double cpu = after.cpu_seconds - before.cpu_seconds;
+    double system = after.system_seconds - before.system_seconds;
+    std::cout << name << ": " << messages / seconds / 1e3 << " k msg/s, "
+        << "server " << cpu / messages * 1e6 << " us CPU/msg ("
+        << static_cast<int>(cpu > 0 ? 100 * system / cpu : 0)
+        << "% system), "
+        << after.context_switches - before.context_switches
+        << " context switches";
+    if (uring)
+        std::cout << ", " << after.enters - before.enters
+            << " io_uring_enter calls";
+    std::cout << "\n";
+}
+
+int main(int argc, const char **argv) {
+    std::size_t connections = argc > 1 ?
+        std::strtoul(argv[1], nullptr, 10) : 1000;
+    std::size_t messages = argc > 2 ? std::strtoul(argv[2], nullptr, 10) :
+        500000;
+    std::size_t size = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 32;
+    if (!connections || messages < connections) {
+        std::cerr << "connections must be positive and messages at least "
+            "connections\n";
+        return EXIT_FAILURE;
+    }
+
+    rlimit rl;
+    if (::getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    try {
+        run("epoll", false, connections, messages, size);
+        run("io_uring", true, connections, messages, size);
+    } catch (std::exception &e) {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -1,6 +1,9 @@
 #ifndef WS_HPP
 #define WS_HPP
 
+#include "ws/acceptor.hpp"
+#include "ws/frame.hpp"
+#include "ws/history.hpp"
 #include "ws/message.hpp"
 #include "ws/session.hpp"
 
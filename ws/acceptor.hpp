@@ -0,0 +1,179 @@
+#ifndef WS_ACCEPTOR_HPP
+#define WS_ACCEPTOR_HPP
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <boost/asio.hpp>
+
+namespace ws {
+
+struct acceptor_options {
+    acceptor_options() :
+        backlog(boost::asio::socket_base::max_listen_connections),
+        batch_size(64), resource_backoff(std::chrono::milliseconds(50)) { }
+
+    /* Length of the kernel's queue of pending connections */
+    int backlog;
+    /* Most connections accepted per readiness wakeup */
+    std::size_t batch_size;
+    /* Pause before accepting again when out of descriptors or memory */
+    std::chrono::steady_clock::duration resource_backoff;
+    /* io_services new connections are handed to in turn, empty to keep them
+     * on the acceptor's own */
+    std::vector<boost::asio::io_service *> workers;
+};
+
+/* Listening socket that drains pending connections in batches: each time the
+ * socket becomes readable, connections are accepted with non-blocking
+ * accept() until the queue is empty (or batch_size is reached) and handed to
+ * the worker io_services round-robin. Connection storms cost one wakeup per
+ * batch rather than one completion per connection. */
+template <typename Protocol>
+class basic_acceptor {
+public:
+    typedef typename Protocol::socket socket_type;
+    typedef typename Protocol::endpoint endpoint_type;
+    /* Called on the owning worker's thread with the new connection */
+    typedef std::function<void(socket_type)> handler_type;
+
+    basic_acceptor(boost::asio::io_service &io_service,
+        const endpoint_type &endpoint, handler_type handler,
+        const acceptor_options &options = acceptor_options()) :
+        acceptor_(io_service), backoff_timer_(io_service), handler_(handler),
+        options_(options), next_(0)
+    {
+        acceptor_.open(endpoint.protocol());
+        acceptor_.set_option(
+            typename Protocol::acceptor::reuse_address(true));
+        acceptor_.bind(endpoint);
+        acceptor_.listen(options_.backlog);
+        start();
+    }
+
+    /* Accept on an already listening socket, e.g. one inherited through
+     * acquire_listener() */
+    basic_acceptor(boost::asio::io_service &io_service,
+        const Protocol &protocol, int listener_fd, handler_type handler,
+        const acceptor_options &options = acceptor_options()) :
+        acceptor_(io_service), backoff_timer_(io_service), handler_(handler),
+        options_(options), next_(0)
+    {
+        acceptor_.assign(protocol, listener_fd);
+        start();
+    }
+
+    basic_acceptor(const basic_acceptor &) = delete;
+    basic_acceptor &operator=(const basic_acceptor &) = delete;
+
+    void close() {
+        boost::system::error_code ignored;
+        acceptor_.close(ignored);
+        backoff_timer_.cancel();
+    }
+
+    bool is_open() const {
+        return acceptor_.is_open();
+    }
+
+    int native_handle() {
+        return acceptor_.native_handle();
+    }
+
+    endpoint_type local_endpoint() const {
+        return acceptor_.local_endpoint();
+    }
+
+private:
+    typename Protocol::acceptor acceptor_;
+    boost::asio::steady_timer backoff_timer_;
+    handler_type handler_;
+    acceptor_options options_;
+    std::size_t next_;
+
+    void start() {
+        acceptor_.non_blocking(true);
+        wait();
+    }
+
+    void wait() {
+        acceptor_.async_wait(boost::asio::socket_base::wait_read,
+            [this](const boost::system::error_code &ec)
+        {
+            if (ec)
+                return;
+
+            if (accept_batch())
+                wait();
+            else
+                back_off();
+        });
+    }
+
+    /* The pending connections keep the socket readable, so waiting on it
+     * straight away would spin until descriptors or memory free up */
+    void back_off() {
+        backoff_timer_.expires_after(options_.resource_backoff);
+        backoff_timer_.async_wait([this](const boost::system::error_code &ec) {
+            if (!ec)
+                wait();
+        });
+    }
+
+    /* Returns false if accepting stopped for lack of resources */
+    bool accept_batch() {
+        for (std::size_t i = 0; i < options_.batch_size; ++i) {
+            /* An unopened socket costs nothing, the turn is only taken and
+             * the socket only moved to the heap once accept() succeeds */
+            boost::asio::io_service &target = worker();
+            socket_type socket(target);
+
+            boost::system::error_code ec;
+            acceptor_.accept(socket, ec);
+            if (ec == boost::asio::error::would_block ||
+                ec == boost::asio::error::try_again)
+            {
+                /* Queue drained */
+                break;
+            } else if (ec == boost::asio::error::no_descriptors ||
+                ec == boost::asio::error::no_buffer_space ||
+                ec == boost::asio::error::no_memory)
+            {
+                /* Leave the rest queued until resources free up */
+                return false;
+            } else if (ec) {
+                /* The connection failed before it was accepted */
+                continue;
+            }
+
+            ++next_;
+            auto accepted = std::make_shared<socket_type>(std::move(socket));
+            handler_type handler = handler_;
+            boost::asio::post(target, [handler, accepted]() {
+                handler(std::move(*accepted));
+            });
+        }
+        return true;
+    }
+
+    /* Whose turn it is for the next accepted connection */
+    boost::asio::io_service &worker() {
+        if (options_.workers.empty())
+            return static_cast<boost::asio::io_service &>(
+                acceptor_.get_executor().context());
+        return *options_.workers[next_ % options_.workers.size()];
+    }
+};
+
+typedef basic_acceptor<boost::asio::ip::tcp> acceptor;
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+/* Unix domain stream sockets, e.g. behind a proxy on the same host. The
+ * socket path must not exist yet. */
+typedef basic_acceptor<boost::asio::local::stream_protocol> local_acceptor;
+#endif /* BOOST_ASIO_HAS_LOCAL_SOCKETS */
+
+} /* namespace ws */
+
+#endif /* WS_ACCEPTOR_HPP */
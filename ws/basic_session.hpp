@@ -0,0 +1,1370 @@
+#ifndef WS_BASIC_SESSION_HPP
+#define WS_BASIC_SESSION_HPP
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <regex>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif /* __linux__ */
+#include <boost/asio.hpp>
+#include <boost/detail/endian.hpp>
+#include <boost/endian/conversion.hpp>
+#include "base64.hpp"
+#include "capture.hpp"
+#include "frame.hpp"
+#include "handshake.hpp"
+#include "message.hpp"
+#include "pool.hpp"
+#include "rate_limit.hpp"
+#include "sha1.hpp"
+#include "utf8.hpp"
+#include "worker_pool.hpp"
+
+using boost::asio::ip::tcp;
+
+namespace ws {
+
+/* Properties of the stream a session runs over, specialised for streams
+ * that need different treatment (see tls.hpp) */
+template <typename T>
+struct stream_traits {
+    /* Whether queued frames are copied into one contiguous buffer before
+     * being written rather than handed over as a gathered write */
+    static const bool coalesce_writes = false;
+    /* Whether readability of the underlying socket means there is data to
+     * read, allowing idle sessions to wait without a receive buffer */
+    static const bool readiness_reads = true;
+    /* Whether file bodies can go from the page cache straight to the socket
+     * with sendfile(), otherwise they are copied through a bounded buffer */
+#ifdef __linux__
+    static const bool sendfile = true;
+#else
+    static const bool sendfile = false;
+#endif /* __linux__ */
+};
+
+enum class role {
+    server,
+    client
+};
+
+/* Compile-time session options. Derive from this and override the members
+ * that should differ, checks that are disabled compile out of the frame
+ * loop. */
+struct default_policies {
+    /* Only server sessions are implemented */
+    static const ws::role role = ws::role::server;
+    /* Frames with a larger payload fail the connection */
+    static const std::size_t max_frame_size =
+        std::numeric_limits<std::size_t>::max();
+    /* Accept frames with reserved bits set, for use with extensions */
+    static const bool allow_extensions = false;
+    /* Fail the connection on text messages that aren't valid UTF-8 */
+    static const bool validate_utf8 = false;
+};
+
+template <typename Derived, typename T, typename Policies>
+class basic_session;
+
+/* Gives basic_session access to handlers that the derived class keeps
+ * private; derived classes befriend this rather than basic_session */
+class session_access {
+private:
+    template <typename, typename, typename>
+    friend class basic_session;
+
+    template <typename D>
+    static void on_open(D &d) { d.on_open(); }
+
+    template <typename D>
+    static void on_msg(D &d, const message &msg) { d.on_msg(msg); }
+
+    /* Derived's on_msgs() if it has one, otherwise on_msg() for each */
+    template <typename D>
+    static auto on_msgs(D &d, const std::vector<message> &msgs, int)
+        -> decltype(d.on_msgs(msgs), void())
+    {
+        d.on_msgs(msgs);
+    }
+
+    template <typename D>
+    static void on_msgs(D &d, const std::vector<message> &msgs, long) {
+        for (const auto &msg : msgs)
+            d.on_msg(msg);
+    }
+
+    template <typename D>
+    static void on_close(D &d) { d.on_close(); }
+
+    template <typename D>
+    static void on_error(D &d) { d.on_error(); }
+};
+
+/* Websocket session over stream T with statically dispatched handlers.
+ * Derived must provide on_open(), on_msg(const message &), on_close() and
+ * on_error(), public or accessible to ws::session_access, and may provide
+ * on_msgs(const std::vector<message> &) for batched delivery. */
+template <typename Derived, typename T,
+    typename Policies = default_policies>
+class basic_session : public std::enable_shared_from_this<Derived> {
+public:
+    using std::enable_shared_from_this<Derived>::shared_from_this;
+
+    static_assert(Policies::role == role::server,
+        "only server sessions are implemented");
+
+    enum class state {
+        connecting,
+        open,
+        closing,
+        closed
+    };
+
+    basic_session(T& socket_ref) :
+        socket_ref_(socket_ref), state_(state::connecting),
+        read_pending_(false), release_idle_buffer_(false),
+        batch_messages_(false),
+        in_stream_(nullptr), fragment_size_(0),
+        max_write_batch_(default_max_write_batch), close_sent_(false),
+        close_timer_(socket_ref.get_executor()),
+        throttle_timer_(socket_ref.get_executor()),
+        worker_pool_(nullptr), dispatched_(0), capture_(nullptr),
+        capture_id_(0),
+        handshake_timeout_(std::chrono::seconds(default_handshake_timeout)),
+        max_handshake_size_(default_max_handshake_size),
+        handshake_limiter_(nullptr), handshake_slot_(false) { }
+
+    ~basic_session() {
+        release_handshake_slot();
+    }
+
+    void start() {
+        if (handshake_limiter_) {
+            if (!handshake_limiter_->try_acquire(handshake_key_)) {
+                reject(detail::service_unavailable_response());
+                return;
+            }
+            handshake_slot_ = true;
+        }
+
+        /* Slow or silent clients are dropped once the deadline passes */
+        auto self(shared_from_this());
+        close_timer_.expires_after(handshake_timeout_);
+        close_timer_.async_wait(
+            [this, self](const boost::system::error_code &ec)
+        {
+            if (!ec && state_ == state::connecting)
+                handshake_failed();
+        });
+
+        read_handshake();
+    }
+
+    /* Start the closing handshake from outside the session (e.g. when
+     * draining before a restart). If the peer has not completed it within
+     * deadline, the connection is dropped. Safe to call from any thread. */
+    void shutdown(std::chrono::steady_clock::duration deadline) {
+        auto self(shared_from_this());
+        boost::asio::post(socket_ref_.get_executor(), [this, self, deadline]() {
+            if (state_ == state::open)
+                close(deadline);
+        });
+    }
+
+    /* Queue a pre-encoded data frame, dropped unless the session is open.
+     * Must be called on the session's io thread; ws::registry::send_to()
+     * gets it there from any other. */
+    void send(frame_ptr frame) {
+        if (state_ == state::open)
+            enqueue(false, std::vector<frame_ptr>(1, std::move(frame)),
+                nullptr);
+    }
+
+protected:
+    std::unordered_map<std::string, std::string> headers_;
+
+    /* Read the next frame. Not needed (and ignored) when messages are
+     * dispatched to a worker pool or batched, reading then continues by
+     * itself. */
+    void read() {
+        if (!worker_pool_ && !batch_messages_)
+            do_read();
+    }
+
+    /* Time allowed from start() until the handshake response has been
+     * written. Call before start(), as with the other handshake limits. */
+    void set_handshake_timeout(std::chrono::steady_clock::duration timeout) {
+        handshake_timeout_ = timeout;
+    }
+
+    /* Requests with more header bytes than this are answered 431 */
+    void set_max_handshake_size(std::size_t bytes) {
+        max_handshake_size_ = bytes;
+    }
+
+    /* Share a cap on handshakes in progress with other sessions, counted
+     * against this peer's address too if the limiter caps each address */
+    void set_handshake_limiter(handshake_limiter &limiter) {
+        handshake_limiter_ = &limiter;
+        if (limiter.per_address()) {
+            boost::system::error_code ec;
+            auto endpoint = socket_ref_.lowest_layer().remote_endpoint(ec);
+            if (!ec)
+                handshake_key_ = peer_key(endpoint);
+        }
+    }
+
+    /* Deliver all the messages decoded from one socket read to on_msgs() in
+     * a single call (on_msg() for each if Derived has no on_msgs()). Reading
+     * resumes by itself once the call returns. Takes effect from the next
+     * read, so call it from on_open(). */
+    void set_message_batching(bool batch) {
+        batch_messages_ = batch;
+    }
+
+    /* Run on_msg on pool instead of the io thread. Messages from this session
+     * are still handled in order, one at a time; reading carries on while
+     * they are, pausing when max_dispatched are waiting. write() and close()
+     * may be called from the handler, their callbacks run on the io thread.
+     * on_close and on_error then run on the pool too, after every message
+     * dispatched before them. */
+    void set_worker_pool(worker_pool &pool) {
+        worker_pool_ = &pool;
+        strand_.reset(new boost::asio::io_service::strand(
+            pool.get_io_service()));
+    }
+
+    /* Limit the rate of messages and bytes this session may send us */
+    void set_rate_limits(const rate_limits &limits) {
+        rate_limiter_ = std::make_shared<rate_limiter>(limits);
+    }
+
+    /* Also draw from a budget shared by all sessions from the same remote
+     * address. Unix socket peers are usually unnamed and then all share one
+     * budget. */
+    void set_address_rate_limiter(address_rate_limiter &limiter) {
+        boost::system::error_code ec;
+        auto endpoint = socket_ref_.lowest_layer().remote_endpoint(ec);
+        if (!ec)
+            address_rate_limiter_ = limiter.get(peer_key(endpoint));
+    }
+
+    /* Record every frame received from now on to c */
+    void set_capture(capture &c) {
+        capture_ = &c;
+        capture_id_ = c.next_session_id();
+    }
+
+    /* Only hold a receive buffer while frames are being decoded, so that idle
+     * sessions cost no receive memory. Ignored for streams where socket
+     * readiness doesn't imply readable data (TLS). */
+    void set_release_idle_buffer(bool release) {
+        release_idle_buffer_ = release;
+    }
+
+    /* Async write data out. Frames written while an earlier write is still in
+     * progress are queued and sent together once it completes. Control frames
+     * (ping, pong, close) skip ahead of queued data and go out with the next
+     * write; data queued behind a close frame is never sent. */
+    /* TODO: check that state is open before sending a binary or text message */
+    void write(message::opcode opcode, const boost::asio::const_buffer &buffer,
+        std::function<void()> cb)
+    {
+        if (worker_pool::on_worker_thread()) {
+            /* Encode here, queue on the io thread */
+            auto self(shared_from_this());
+            std::vector<frame_ptr> frames = encode(opcode, buffer);
+            boost::asio::post(socket_ref_.get_executor(),
+                [this, self, opcode, frames, cb]()
+            {
+                enqueue(is_control(opcode), frames, cb);
+            });
+            return;
+        }
+
+        enqueue(is_control(opcode), encode(opcode, buffer), cb);
+    }
+
+    /* Send data messages larger than size as fragments of size bytes, 0 (the
+     * default) never fragments */
+    void set_fragment_size(std::size_t size) {
+        fragment_size_ = size;
+    }
+
+    /* Upper bound on the data bytes handed to one write, which bounds how long
+     * a control frame can wait behind data */
+    void set_max_write_batch(std::size_t bytes) {
+        max_write_batch_ = bytes;
+    }
+
+    /* Async write a batch of pre-encoded frames, cb is called once the last
+     * of them has been written */
+    void write(const std::vector<frame_ptr> &frames, std::function<void()> cb) {
+        if (worker_pool::on_worker_thread()) {
+            auto self(shared_from_this());
+            boost::asio::post(socket_ref_.get_executor(),
+                [this, self, frames, cb]() { enqueue(false, frames, cb); });
+            return;
+        }
+
+        enqueue(false, frames, cb);
+    }
+
+    /* Async write length bytes of the file fd, starting at offset, as one
+     * message, fragmented if larger than the fragment size. On plain sockets
+     * the body is sent with sendfile() and never copied into user space;
+     * otherwise it is streamed through a bounded buffer. fd must stay open
+     * until cb is called. */
+    void write_file(message::opcode opcode, int fd, off_t offset,
+        std::size_t length, std::function<void()> cb)
+    {
+        if (worker_pool::on_worker_thread()) {
+            auto self(shared_from_this());
+            boost::asio::post(socket_ref_.get_executor(),
+                [this, self, opcode, fd, offset, length, cb]()
+            {
+                write_file(opcode, fd, offset, length, cb);
+            });
+            return;
+        }
+
+        if (close_sent_)
+            return;
+
+        /* Fragmented like encode(), one header and file body per fragment,
+         * so control frames can be sent between them */
+        std::size_t fragment = fragment_size_ && length > fragment_size_ ?
+            fragment_size_ : length;
+        std::size_t sent = 0;
+        do {
+            std::size_t size = std::min(fragment, length - sent);
+            bool fin = sent + size == length;
+
+            std::array<unsigned char, max_frame_header_length> header;
+            std::size_t header_length = encode_frame_header(
+                sent ? message::opcode::continuation : opcode, size, header,
+                fin);
+            auto f = std::make_shared<frame>(header.begin(),
+                header.begin() + header_length);
+            auto body = std::make_shared<file_body>();
+            body->fd = fd;
+            body->offset = offset + sent;
+            body->remaining = size;
+
+            write_queue_.push_back(pending_write(f, fin ? cb : nullptr,
+                body));
+            sent += size;
+        } while (sent < length);
+        flush();
+    }
+
+    /* Close connection (initiates closing handshake) */
+    void close() {
+        if (worker_pool::on_worker_thread()) {
+            auto self(shared_from_this());
+            boost::asio::post(socket_ref_.get_executor(),
+                [this, self]() { close(); });
+            return;
+        }
+
+        bool client_initiated = state_ == state::closing;
+        state_ = state::closing;
+        write(message::opcode::connection_close, {},
+            [this, client_initiated]()
+        {
+            if (client_initiated) {
+                closed();
+            } else if (state_ == state::closing && !read_pending_) {
+                /* We initiated close, wait for the client's close frame */
+                do_read();
+            }
+        });
+    }
+
+    /* Close connection, dropping it if the closing handshake has not
+     * completed within deadline */
+    void close(std::chrono::steady_clock::duration deadline) {
+        auto self(shared_from_this());
+        close_timer_.expires_after(deadline);
+        close_timer_.async_wait(
+            [this, self](const boost::system::error_code &ec)
+        {
+            if (!ec && state_ != state::closed) {
+                boost::system::error_code ignored;
+                socket_ref_.lowest_layer().close(ignored);
+                closed();
+            }
+        });
+        close();
+    }
+
+    const T &get_socket() {
+        return socket_ref_;
+    }
+
+private:
+    struct file_body {
+        int fd;
+        off_t offset;
+        std::size_t remaining;
+    };
+
+    struct pending_write {
+        pending_write(frame_ptr f, std::function<void()> c,
+            std::shared_ptr<file_body> b = nullptr) :
+            frame(std::move(f)), cb(std::move(c)), file(std::move(b)) { }
+
+        frame_ptr frame;
+        std::function<void()> cb;
+        /* Body streamed after frame, which then only holds the header */
+        std::shared_ptr<file_body> file;
+    };
+
+    T &socket_ref_;
+    state state_;
+    bool read_pending_;
+    bool release_idle_buffer_;
+    bool batch_messages_;
+    streambuf_pool::pointer in_buffer_;
+    boost::asio::streambuf out_buffer_;
+    std::istream in_stream_;
+    std::vector<pending_write> control_queue_;
+    std::deque<pending_write> write_queue_;
+    std::vector<pending_write> writing_;
+    std::size_t fragment_size_;
+    std::size_t max_write_batch_;
+    bool close_sent_;
+    std::vector<unsigned char> coalesce_buffer_;
+    std::vector<unsigned char> file_buffer_;
+    std::array<unsigned char, 2> header_;
+    boost::asio::steady_timer close_timer_;
+    boost::asio::steady_timer throttle_timer_;
+    std::shared_ptr<rate_limiter> rate_limiter_;
+    std::shared_ptr<rate_limiter> address_rate_limiter_;
+    worker_pool *worker_pool_;
+    std::unique_ptr<boost::asio::io_service::strand> strand_;
+    std::size_t dispatched_;
+    /* Messages decoded from the current read, when batching */
+    std::vector<message> batch_;
+    capture *capture_;
+    std::uint64_t capture_id_;
+    std::chrono::steady_clock::duration handshake_timeout_;
+    std::size_t max_handshake_size_;
+    handshake_limiter *handshake_limiter_;
+    /* Whether this session counts against handshake_limiter_, and under
+     * which address */
+    bool handshake_slot_;
+    std::string handshake_key_;
+
+    enum {
+        default_max_write_batch = 64 * 1024,
+        /* Read size for message batching unless a larger frame is
+         * partly buffered */
+        batch_read_size = 4 * 1024,
+        max_batch_read_size = 64 * 1024,
+        /* Seconds */
+        default_handshake_timeout = 10,
+        default_max_handshake_size = 16 * 1024,
+        handshake_read_size = 4 * 1024,
+        /* Largest slice of a file body sent at once, and the buffer used
+         * for those that can't be sent with sendfile() */
+        file_chunk_size = 64 * 1024,
+        /* Messages waiting on the worker pool before reading pauses */
+        max_dispatched = 64
+    };
+
+    /* Key under which an address_rate_limiter groups peers */
+    static std::string peer_key(
+        const boost::asio::ip::tcp::endpoint &endpoint)
+    {
+        return endpoint.address().to_string();
+    }
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+    static std::string peer_key(
+        const boost::asio::local::stream_protocol::endpoint &endpoint)
+    {
+        return endpoint.path();
+    }
+#endif /* BOOST_ASIO_HAS_LOCAL_SOCKETS */
+
+    static bool is_control(message::opcode opcode) {
+        return static_cast<unsigned char>(opcode) & 0x08;
+    }
+
+    static message::opcode frame_opcode(const frame &f) {
+        return static_cast<message::opcode>(f[0] & 0x0f);
+    }
+
+    Derived &derived() {
+        return static_cast<Derived &>(*this);
+    }
+
+    std::string generate_accept(const std::string &key) const {
+        const std::string GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+        std::string formed = key + GUID;
+
+        /* SHA1 hash the formed string */
+        std::array<char, 20> hash;
+        sha1hash(formed, hash);
+
+        /* Base64 encode the SHA1 hash */
+        return base64encode(hash.data(), hash.size());
+    }
+
+    /* While the peer is over its rate limits reading is paused (nothing is
+     * dropped) until enough tokens have refilled */
+    void do_read() {
+        auto self(shared_from_this());
+        read_pending_ = true;
+
+        rate_limiter::clock::duration delay = throttle_delay();
+        if (delay > rate_limiter::clock::duration::zero()) {
+            throttle_timer_.expires_after(delay);
+            throttle_timer_.async_wait(
+                [this, self](const boost::system::error_code &ec)
+            {
+                if (!ec) {
+                    receive();
+                }
+            });
+        } else {
+            receive();
+        }
+    }
+
+    void receive() {
+        if (release_idle_buffer_ && stream_traits<T>::readiness_reads &&
+            (!in_buffer_ || in_buffer_->size() == 0))
+        {
+            /* Hand the receive buffer back while the peer is quiet and
+             * borrow one again once there is something to decode */
+            auto self(shared_from_this());
+            release_in_buffer();
+            socket_ref_.lowest_layer().async_wait(
+                boost::asio::socket_base::wait_read,
+                [this, self](const boost::system::error_code &ec)
+            {
+                if (!ec) {
+                    read_frame();
+                }
+            });
+        } else {
+            read_frame();
+        }
+    }
+
+    /* Hand msg to the worker pool and keep reading unless too many messages
+     * are already waiting there */
+    void dispatch(message msg) {
+        auto m = std::make_shared<message>(std::move(msg));
+        dispatch_to_pool([this, m]() {
+            session_access::on_msg(derived(), *m);
+        });
+
+        if (dispatched_ < max_dispatched)
+            do_read();
+    }
+
+    /* Run handler on the strand, resuming reading afterwards if it had been
+     * paused because too much was waiting */
+    template <typename Handler>
+    void dispatch_to_pool(Handler handler) {
+        auto self(shared_from_this());
+
+        ++dispatched_;
+        boost::asio::post(*strand_, [this, self, handler]() {
+            handler();
+            boost::asio::post(socket_ref_.get_executor(), [this, self]() {
+                bool paused = dispatched_ == max_dispatched;
+                --dispatched_;
+                if (paused && state_ == state::open && !read_pending_)
+                    do_read();
+            });
+        });
+    }
+
+    /* Every frame read counts against the limits, control frames included,
+     * so a ping flood can't get around them */
+    void charge(std::size_t bytes) {
+        if (rate_limiter_)
+            rate_limiter_->consume(bytes);
+        if (address_rate_limiter_)
+            address_rate_limiter_->consume(bytes);
+    }
+
+    rate_limiter::clock::duration throttle_delay() {
+        rate_limiter::clock::duration delay =
+            rate_limiter::clock::duration::zero();
+        if (rate_limiter_)
+            delay = rate_limiter_->delay();
+        if (address_rate_limiter_)
+            delay = std::max(delay, address_rate_limiter_->delay());
+        return delay;
+    }
+
+    void read_frame() {
+        if (batch_messages_) {
+            read_batch();
+            return;
+        }
+
+        auto self(shared_from_this());
+        acquire_in_buffer();
+        boost::asio::async_read(socket_ref_, *in_buffer_,
+            boost::asio::transfer_exactly(header_.size()),
+            [this, self](const boost::system::error_code &ec, std::size_t)
+        {
+            if (!ec) {
+                in_stream_.read(reinterpret_cast<char *>(
+                    header_.data()), header_.size());
+
+                /* Only handle fin messages (right now at least), fail the
+                 * connection on anything else rather than stalling it */
+                if (!(header_[0] >> 7)) {
+                    fail();
+                    return;
+                }
+
+                /* If reserved bits are not 0 and no extension can have set
+                 * them, fail */
+                if (!Policies::allow_extensions && ((header_[0] & 0x40) |
+                    (header_[0] & 0x20) | (header_[0] & 0x10)))
+                {
+                    fail();
+                    return;
+                }
+
+                /* Client frames must be masked */
+                if (!(header_[1] >> 7)) {
+                    fail();
+                    return;
+                }
+
+                std::size_t payload_length = header_[1] & 0x7f;
+                if (payload_length < 126) {
+                    /* Read message mask and payload */
+                    read_mask_and_payload(payload_length);
+                } else if (payload_length == 126) {
+                    /* read 2 more bytes and assign this uint16_t to
+                     * payload_length */
+                    boost::asio::async_read(socket_ref_, *in_buffer_,
+                        boost::asio::transfer_exactly(2),
+                        [this, self](const boost::system::error_code &ec,
+                            std::size_t)
+                    {
+                        if (!ec) {
+                            uint16_t u16;
+                            in_stream_.read(reinterpret_cast<char *>(&u16), 2);
+#ifndef BOOST_BIG_ENDIAN
+                            u16 = boost::endian::endian_reverse(u16);
+#endif /* BOOST_BIG_ENDIAN */
+                            std::size_t payload_length = u16;
+                            read_mask_and_payload(payload_length);
+                        }
+                    });
+                } else {
+                    /* read 8 more bytes and assign this uint64_t to
+                     * payload_length */
+                    boost::asio::async_read(socket_ref_, *in_buffer_,
+                        boost::asio::transfer_exactly(8),
+                        [this, self](const boost::system::error_code &ec,
+                            std::size_t)
+                    {
+                        if (!ec) {
+                            uint64_t u64;
+                            in_stream_.read(reinterpret_cast<char *>(&u64), 8);
+#ifndef BOOST_BIG_ENDIAN
+                            u64 = boost::endian::endian_reverse(u64);
+#endif /* BOOST_BIG_ENDIAN */
+                            std::size_t payload_length = u64;
+                            read_mask_and_payload(payload_length);
+                        }
+                    });
+                }
+            }
+        });
+    }
+
+    /* Read whatever the socket has and decode every complete frame in it */
+    void read_batch() {
+        auto self(shared_from_this());
+        acquire_in_buffer();
+
+        std::size_t header_length, frame_length;
+        if (buffered_frame(header_length, frame_length) &&
+            (in_buffer_->size() >= frame_length ||
+            frame_length == std::numeric_limits<std::size_t>::max()))
+        {
+            /* Left over from the handshake */
+            boost::asio::post(socket_ref_.get_executor(), [this, self]() {
+                read_pending_ = false;
+                decode_batch();
+            });
+            return;
+        }
+
+        /* Only as much room as the incomplete frame still needs, so a
+         * session receiving small messages keeps a small buffer, and never
+         * more than max_batch_read_size at once, so the buffer grows with
+         * the data that arrives rather than with the length a header
+         * claims */
+        std::size_t read_size = batch_read_size;
+        if (buffered_frame(header_length, frame_length))
+            read_size = std::min<std::size_t>(std::max<std::size_t>(
+                frame_length - in_buffer_->size(), batch_read_size),
+                max_batch_read_size);
+
+        socket_ref_.async_read_some(in_buffer_->prepare(read_size),
+            [this, self](const boost::system::error_code &ec, std::size_t n)
+        {
+            read_pending_ = false;
+            if (!ec) {
+                in_buffer_->commit(n);
+                decode_batch();
+            }
+        });
+    }
+
+    /* Parse the header of the first buffered frame, false if it hasn't fully
+     * arrived yet */
+    bool buffered_frame(std::size_t &header_length,
+        std::size_t &frame_length) const
+    {
+        const unsigned char *p = boost::asio::buffer_cast<
+            const unsigned char *>(in_buffer_->data());
+        std::size_t available = in_buffer_->size();
+        if (available < 2)
+            return false;
+
+        std::uint64_t payload_length = p[1] & 0x7f;
+        header_length = payload_length == 126 ? 4 :
+            payload_length == 127 ? 10 : 2;
+        if (available < header_length)
+            return false;
+
+        if (payload_length == 126) {
+            payload_length = std::uint64_t(p[2]) << 8 | p[3];
+        } else if (payload_length == 127) {
+            payload_length = 0;
+            for (std::size_t i = 0; i < 8; ++i)
+                payload_length = payload_length << 8 | p[2 + i];
+        }
+
+        /* Oversized frames fail the connection before anything is read */
+        if (payload_length > Policies::max_frame_size ||
+            payload_length > std::numeric_limits<std::size_t>::max() -
+                header_length - 4)
+        {
+            frame_length = std::numeric_limits<std::size_t>::max();
+        } else {
+            frame_length = header_length + 4 + payload_length;
+        }
+        return true;
+    }
+
+    void decode_batch() {
+        bool close_frame = false;
+        std::size_t header_length, frame_length;
+
+        while (!close_frame && buffered_frame(header_length, frame_length)) {
+            const unsigned char *p = boost::asio::buffer_cast<
+                const unsigned char *>(in_buffer_->data());
+
+            /* Fragmented, unmasked and (unless allowed) extension frames are
+             * protocol violations */
+            if (!(p[0] & 0x80) || !(p[1] & 0x80) ||
+                (!Policies::allow_extensions && (p[0] & 0x70)) ||
+                frame_length == std::numeric_limits<std::size_t>::max())
+            {
+                fail();
+                return;
+            }
+            if (in_buffer_->size() < frame_length)
+                break;
+
+            std::array<unsigned char, 4> mask;
+            std::memcpy(mask.data(), p + header_length, mask.size());
+            message msg(static_cast<message::opcode>(p[0] & 0x0f),
+                frame_length - header_length - 4);
+            payload &data = msg.get_payload();
+            if (!data.empty())
+                std::memcpy(data.data(), p + header_length + 4, data.size());
+            in_buffer_->consume(frame_length);
+
+            unmask_data(mask, data);
+            if (capture_)
+                capture_->record(capture_id_, msg.get_opcode(),
+                    data.data(), data.size());
+            if (Policies::validate_utf8 &&
+                msg.get_opcode() == message::opcode::text &&
+                !valid_utf8(data.data(), data.size()))
+            {
+                fail();
+                return;
+            }
+
+            charge(data.size());
+            switch (msg.get_opcode()) {
+                case message::opcode::text:
+                case message::opcode::binary:
+                    batch_.push_back(std::move(msg));
+                    break;
+                case message::opcode::ping:
+                    pong(boost::asio::buffer(data.data(), data.size()));
+                    break;
+                case message::opcode::connection_close:
+                    close_frame = true;
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        if (!batch_.empty()) {
+            if (worker_pool_) {
+                auto msgs = std::make_shared<std::vector<message>>(
+                    std::move(batch_));
+                batch_.clear();
+                dispatch_to_pool([this, msgs]() {
+                    session_access::on_msgs(derived(), *msgs, 0);
+                });
+            } else {
+                session_access::on_msgs(derived(), batch_, 0);
+                batch_.clear();
+            }
+        }
+
+        if (close_frame) {
+            close_received();
+        } else if ((state_ == state::open || state_ == state::closing) &&
+            !read_pending_ && dispatched_ < max_dispatched)
+        {
+            do_read();
+        }
+    }
+
+    /* Read until the end of the request headers, answering 431 once more
+     * than max_handshake_size_ bytes have arrived without it */
+    void read_handshake() {
+        auto self(shared_from_this());
+        acquire_in_buffer();
+
+        std::size_t searched = in_buffer_->size() >= 3 ?
+            in_buffer_->size() - 3 : 0;
+        std::size_t room = max_handshake_size_ - in_buffer_->size();
+        socket_ref_.async_read_some(in_buffer_->prepare(
+            std::min<std::size_t>(room, handshake_read_size)),
+            [this, self, searched](const boost::system::error_code &ec,
+                std::size_t n)
+        {
+            if (ec) {
+                handshake_failed();
+                return;
+            }
+            in_buffer_->commit(n);
+
+            static const char terminator[] = "\r\n\r\n";
+            const char *begin = boost::asio::buffer_cast<const char *>(
+                in_buffer_->data());
+            const char *end = begin + in_buffer_->size();
+            if (std::search(begin + searched, end, terminator,
+                terminator + 4) != end)
+            {
+                process_handshake();
+            } else if (in_buffer_->size() >= max_handshake_size_) {
+                reject(detail::header_too_large_response());
+            } else {
+                read_handshake();
+            }
+        });
+    }
+
+    /* Successfully received request, process it */
+    void process_handshake() {
+        std::istream request(in_buffer_.get());
+        std::ostream response(&out_buffer_);
+
+        /* Request line: GET <target> HTTP/1.1 */
+        std::string line;
+        std::getline(request, line);
+        if (line.compare(0, 4, "GET ") != 0 || line.size() < 14 ||
+            line.compare(line.size() - 10, 10, " HTTP/1.1\r") != 0)
+        {
+            reject(detail::bad_request_response());
+            return;
+        }
+
+        /* Parse HTTP header key-value pairs */
+        std::string header;
+        while (std::getline(request, header) && header != "\r") {
+            std::regex expr("(.*): (.*)");
+            auto it = std::sregex_iterator(header.begin(), header.end(), expr);
+            if (it != std::sregex_iterator())
+                headers_[it->str(1)] = it->str(2);
+        }
+
+        /* RFC 6455 4.2.1: an upgrade to websocket, with a key of 16 base64
+         * encoded bytes */
+        const std::string *upgrade = detail::find_header(headers_, "Upgrade");
+        const std::string *connection = detail::find_header(headers_,
+            "Connection");
+        const std::string *key = detail::find_header(headers_,
+            "Sec-WebSocket-Key");
+        if (!upgrade || !detail::has_token(*upgrade, "websocket") ||
+            !connection || !detail::has_token(*connection, "upgrade") ||
+            !key || key->size() != 24 || key->compare(22, 2, "==") != 0)
+        {
+            reject(detail::bad_request_response());
+            return;
+        }
+
+        const std::string *version = detail::find_header(headers_,
+            "Sec-WebSocket-Version");
+        if (!version || *version != "13") {
+            reject(detail::upgrade_required_response());
+            return;
+        }
+        std::string accept = generate_accept(*key);
+
+        response << "HTTP/1.1 101 Switching Protocols\r\n"
+            << "Upgrade: websocket\r\n"
+            << "Connection: Upgrade\r\n"
+            << "Sec-WebSocket-Accept: " << accept << "\r\n"
+            << "\r\n";
+
+        write_handshake();
+    }
+
+    void write_handshake() {
+        auto self(shared_from_this());
+        boost::asio::async_write(socket_ref_, out_buffer_,
+            [this, self](const boost::system::error_code &ec, std::size_t)
+        {
+            if (ec || state_ != state::connecting) {
+                handshake_failed();
+                return;
+            }
+
+            state_ = state::open;
+            close_timer_.cancel();
+            release_handshake_slot();
+            session_access::on_open(derived());
+            do_read();
+        });
+    }
+
+    /* Turn the client away with a pre-built response, then drop it */
+    void reject(const std::string &response) {
+        auto self(shared_from_this());
+        state_ = state::closed;
+        release_handshake_slot();
+        boost::asio::async_write(socket_ref_, boost::asio::buffer(response),
+            [this, self](const boost::system::error_code &, std::size_t)
+        {
+            close_timer_.cancel();
+            boost::system::error_code ignored;
+            socket_ref_.lowest_layer().close(ignored);
+        });
+    }
+
+    /* The handshake can't complete: read error or deadline passed */
+    void handshake_failed() {
+        state_ = state::closed;
+        close_timer_.cancel();
+        boost::system::error_code ignored;
+        socket_ref_.lowest_layer().close(ignored);
+        release_handshake_slot();
+    }
+
+    void release_handshake_slot() {
+        if (handshake_slot_) {
+            handshake_slot_ = false;
+            handshake_limiter_->release(handshake_key_);
+        }
+    }
+
+    /* Encode a message, split into fragments if it is a data message larger
+     * than the fragment size */
+    std::vector<frame_ptr> encode(message::opcode opcode,
+        const boost::asio::const_buffer &buffer) const
+    {
+        std::vector<frame_ptr> frames;
+        std::size_t length = boost::asio::buffer_size(buffer);
+        if (is_control(opcode) || !fragment_size_ || length <= fragment_size_) {
+            frames.push_back(make_frame(opcode, buffer));
+            return frames;
+        }
+
+        /* Fragmented so that control frames can be sent between them */
+        for (std::size_t offset = 0; offset < length;
+            offset += fragment_size_)
+        {
+            frames.push_back(make_frame(
+                offset ? message::opcode::continuation : opcode,
+                boost::asio::buffer(buffer + offset, fragment_size_),
+                length - offset <= fragment_size_));
+        }
+        return frames;
+    }
+
+    /* Answer a ping. At most one pong waits behind the write in progress: a
+     * newer ping replaces its payload (RFC 6455 5.5.3), so a peer that pings
+     * without reading can't grow the queue. */
+    void pong(const boost::asio::const_buffer &buffer) {
+        if (close_sent_)
+            return;
+
+        frame_ptr f = make_frame(message::opcode::pong, buffer);
+        for (auto &w : control_queue_) {
+            if (!w.cb && frame_opcode(*w.frame) == message::opcode::pong) {
+                w.frame = std::move(f);
+                return;
+            }
+        }
+        control_queue_.push_back(pending_write(std::move(f), nullptr));
+        flush();
+    }
+
+    /* Queue frames on the control or data lane, cb is called once the last of
+     * them has been written */
+    void enqueue(bool control, const std::vector<frame_ptr> &frames,
+        std::function<void()> cb)
+    {
+        if (close_sent_)
+            return;
+
+        if (frames.empty()) {
+            if (cb)
+                boost::asio::post(socket_ref_.get_executor(), cb);
+            return;
+        }
+
+        for (std::size_t i = 0; i < frames.size(); ++i) {
+            pending_write w(frames[i], i + 1 == frames.size() ? cb : nullptr);
+            if (control)
+                control_queue_.push_back(std::move(w));
+            else
+                write_queue_.push_back(std::move(w));
+        }
+        flush();
+    }
+
+    /* Send everything queued since the last write, one write at a time */
+    void flush() {
+        if (!writing_.empty() ||
+            (control_queue_.empty() && write_queue_.empty()))
+        {
+            return;
+        }
+
+        auto self(shared_from_this());
+
+        /* Control frames first, then data up to the batch limit (but always
+         * at least one frame) */
+        writing_.swap(control_queue_);
+        std::size_t bytes = 0;
+        while (!write_queue_.empty() &&
+            (bytes < max_write_batch_ || writing_.empty()))
+        {
+            bool file = write_queue_.front().file != nullptr;
+            bytes += write_queue_.front().frame->size();
+            writing_.push_back(std::move(write_queue_.front()));
+            write_queue_.pop_front();
+
+            /* The file body follows its header, after the batch */
+            if (file)
+                break;
+        }
+
+        auto handler = [this, self](const boost::system::error_code &ec,
+            std::size_t)
+        {
+            if (!ec && writing_.back().file) {
+                send_file(writing_.back().file,
+                    [this, self](const boost::system::error_code &ec) {
+                        /* The header promised bytes that never went out,
+                         * anything sent after it would land in the payload */
+                        if (ec)
+                            fail();
+                        write_done(ec);
+                    },
+                    std::integral_constant<bool,
+                        stream_traits<T>::sendfile>());
+            } else {
+                write_done(ec);
+            }
+        };
+
+        if (stream_traits<T>::coalesce_writes) {
+            /* One contiguous buffer so the stream can emit full-size
+             * records rather than one per frame */
+            coalesce_buffer_.clear();
+            for (auto &w : writing_)
+                coalesce_buffer_.insert(coalesce_buffer_.end(),
+                    w.frame->begin(), w.frame->end());
+            boost::asio::async_write(socket_ref_,
+                boost::asio::buffer(coalesce_buffer_), handler);
+        } else {
+            std::vector<boost::asio::const_buffer> buffers;
+            buffers.reserve(writing_.size());
+            for (auto &w : writing_)
+                buffers.push_back(boost::asio::buffer(*w.frame));
+            boost::asio::async_write(socket_ref_, buffers, handler);
+        }
+    }
+
+    void write_done(const boost::system::error_code &ec) {
+        std::vector<pending_write> done;
+        done.swap(writing_);
+        if (!ec) {
+            for (auto &w : done) {
+                if (frame_opcode(*w.frame) ==
+                    message::opcode::connection_close)
+                {
+                    /* Nothing may follow a close frame */
+                    close_sent_ = true;
+                    write_queue_.clear();
+                }
+                if (w.cb) {
+                    w.cb();
+                }
+            }
+            flush();
+        }
+    }
+
+    typedef std::function<void(const boost::system::error_code &)>
+        file_handler;
+
+#ifdef __linux__
+    /* Zero-copy file body: sendfile() in slices of at most file_chunk_size
+     * until done, waiting for the socket to become writable whenever it is
+     * full and yielding the io thread to other sessions between slices */
+    void send_file(std::shared_ptr<file_body> file, file_handler done,
+        std::true_type)
+    {
+        auto &socket = socket_ref_.lowest_layer();
+        boost::system::error_code ec;
+        socket.native_non_blocking(true, ec);
+
+        while (!ec && file->remaining) {
+            ssize_t n = ::sendfile(socket.native_handle(), file->fd,
+                &file->offset, std::min<std::size_t>(file->remaining,
+                file_chunk_size));
+            if (n > 0) {
+                file->remaining -= n;
+                if (file->remaining) {
+                    auto self(shared_from_this());
+                    boost::asio::post(socket_ref_.get_executor(),
+                        [this, self, file, done]()
+                    {
+                        send_file(file, done, std::true_type());
+                    });
+                    return;
+                }
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                auto self(shared_from_this());
+                socket.async_wait(boost::asio::socket_base::wait_write,
+                    [this, self, file, done](
+                        const boost::system::error_code &ec)
+                {
+                    if (ec)
+                        done(ec);
+                    else
+                        send_file(file, done, std::true_type());
+                });
+                return;
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else {
+                /* A file shorter than promised would corrupt the stream */
+                ec = n < 0 ? boost::system::error_code(errno,
+                    boost::system::system_category()) :
+                    boost::asio::error::eof;
+            }
+        }
+        done(ec);
+    }
+#endif /* __linux__ */
+
+    /* Copying file body, one bounded chunk at a time */
+    void send_file(std::shared_ptr<file_body> file, file_handler done,
+        std::false_type)
+    {
+        if (!file->remaining) {
+            done(boost::system::error_code());
+            return;
+        }
+
+        file_buffer_.resize(std::min<std::size_t>(file->remaining,
+            file_chunk_size));
+        ssize_t n = ::pread(file->fd, file_buffer_.data(),
+            file_buffer_.size(), file->offset);
+        if (n <= 0) {
+            done(n < 0 ? boost::system::error_code(errno,
+                boost::system::system_category()) : boost::asio::error::eof);
+            return;
+        }
+        file->offset += n;
+        file->remaining -= n;
+
+        auto self(shared_from_this());
+        boost::asio::async_write(socket_ref_,
+            boost::asio::buffer(file_buffer_.data(), n),
+            [this, self, file, done](const boost::system::error_code &ec,
+                std::size_t)
+        {
+            if (ec)
+                done(ec);
+            else
+                send_file(file, done, std::false_type());
+        });
+    }
+
+    void read_mask_and_payload(std::size_t payload_length) {
+        if (payload_length > Policies::max_frame_size) {
+            fail();
+            return;
+        }
+
+        auto self(shared_from_this());
+        boost::asio::async_read(socket_ref_, *in_buffer_,
+            boost::asio::transfer_exactly(4 + payload_length),
+            [this, self, payload_length](const boost::system::error_code &ec,
+                std::size_t)
+        {
+            read_pending_ = false;
+            if (!ec) {
+                std::array<unsigned char, 4> mask;
+                message msg(static_cast<message::opcode>(header_[0] & 0x0f),
+                    payload_length);
+                payload &data = msg.get_payload();
+                in_stream_.read((char *)mask.data(), mask.size());
+                in_stream_.read((char *)data.data(), data.size());
+                unmask_data(mask, data);
+                if (capture_)
+                    capture_->record(capture_id_, msg.get_opcode(),
+                        data.data(), data.size());
+                if (Policies::validate_utf8 &&
+                    msg.get_opcode() == message::opcode::text &&
+                    !valid_utf8(data.data(), data.size()))
+                {
+                    fail();
+                    return;
+                }
+
+                charge(data.size());
+                switch (msg.get_opcode()) {
+                    case message::opcode::text:
+                    case message::opcode::binary:
+                        if (worker_pool_)
+                            dispatch(std::move(msg));
+                        else
+                            session_access::on_msg(derived(), msg);
+                        // TODO: read() here and test whether close or write has been called?
+                        break;
+                    case message::opcode::ping:
+                        /* Answer straight away on the control lane and keep
+                         * reading */
+                        pong(boost::asio::buffer(data.data(), data.size()));
+                        do_read();
+                        break;
+                    case message::opcode::pong:
+                        do_read();
+                        break;
+                    case message::opcode::connection_close:
+                        close_received();
+                        break;
+                    default:
+                        break;
+                }
+            }
+        });
+    }
+
+    void close_received() {
+        if (state_ == state::closing) {
+            /* We initiated close */
+            closed();
+        } else {
+            /* Client initiated close */
+            state_ = state::closing;
+            close();
+        }
+    }
+
+    void closed() {
+        if (state_ == state::closed)
+            return;
+        state_ = state::closed;
+        close_timer_.cancel();
+        throttle_timer_.cancel();
+        after_dispatched([this]() { session_access::on_close(derived()); });
+    }
+
+    /* Fail the connection after a protocol violation, or when what was
+     * sent can no longer be framed correctly */
+    void fail() {
+        if (state_ == state::closed)
+            return;
+        state_ = state::closed;
+        close_timer_.cancel();
+        throttle_timer_.cancel();
+        boost::system::error_code ignored;
+        socket_ref_.lowest_layer().close(ignored);
+        after_dispatched([this]() { session_access::on_error(derived()); });
+    }
+
+    /* Run handler once the messages already dispatched to the worker pool
+     * have been handled, so it can't overlap or overtake on_msg */
+    template <typename Handler>
+    void after_dispatched(Handler handler) {
+        if (!worker_pool_) {
+            handler();
+            return;
+        }
+
+        auto self(shared_from_this());
+        boost::asio::post(*strand_, [self, handler]() { handler(); });
+    }
+
+    void acquire_in_buffer() {
+        if (!in_buffer_) {
+            in_buffer_ = streambuf_pool::acquire();
+            in_stream_.rdbuf(in_buffer_.get());
+        }
+    }
+
+    void release_in_buffer() {
+        if (in_buffer_) {
+            in_stream_.rdbuf(nullptr);
+            streambuf_pool::release(std::move(in_buffer_));
+        }
+    }
+
+    void unmask_data(const std::array<unsigned char, 4> &mask,
+        payload &data)
+    {
+        for (std::size_t i = 0; i < data.size(); ++i)
+            data[i] = data[i] ^ mask[i % 4];
+    }
+};
+
+} /* namespace ws */
+
+#endif /* WS_BASIC_SESSION_HPP */
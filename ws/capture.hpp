@@ -0,0 +1,268 @@
+#ifndef WS_CAPTURE_HPP
+#define WS_CAPTURE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "message.hpp"
+
+namespace ws {
+
+/* Traffic capture.
+ *
+ * A capture file starts with a capture_file_header followed by records, each
+ * a capture_record_header and its payload padded to 8 bytes, so the file can
+ * be mapped and walked in place. Timestamps are nanoseconds since the epoch.
+ * With capture_mode::hashes only a 64-bit FNV-1a hash of each payload is
+ * kept (original_length still holds the real size). */
+
+const char capture_magic[8] = {'W', 'S', 'C', 'A', 'P', 0, 0, 0};
+const std::uint32_t capture_version = 1;
+
+struct capture_file_header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t reserved;
+};
+
+struct capture_record_header {
+    std::uint64_t timestamp;
+    std::uint64_t session_id;
+    /* Bytes stored after this header, before padding */
+    std::uint32_t length;
+    std::uint32_t original_length;
+    std::uint8_t opcode;
+    std::uint8_t flags;
+    std::uint16_t reserved;
+    std::uint32_t reserved2;
+};
+
+const std::uint8_t capture_flag_hashed = 0x01;
+
+enum class capture_mode {
+    payloads,
+    hashes
+};
+
+inline std::uint64_t fnv1a(const unsigned char *data, std::size_t length) {
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (std::size_t i = 0; i < length; ++i) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* Records decoded frames from any number of io threads. Each thread appends
+ * to its own lock-free single-producer ring; a background thread drains the
+ * rings to the file. Records that don't fit in a full ring are dropped and
+ * counted rather than blocking the io thread. */
+class capture {
+public:
+    enum {
+        default_ring_size = 1 << 20
+    };
+
+    capture(const std::string &path, capture_mode mode = capture_mode::payloads,
+        std::size_t ring_size = default_ring_size) :
+        id_(next_capture_id()), mode_(mode), ring_size_(ring_size),
+        next_session_id_(1), dropped_(0), stopping_(false)
+    {
+        file_ = std::fopen(path.c_str(), "wb");
+        if (!file_)
+            throw std::runtime_error("ws::capture: unable to open " + path);
+
+        capture_file_header header;
+        std::memcpy(header.magic, capture_magic, sizeof (header.magic));
+        header.version = capture_version;
+        header.reserved = 0;
+        std::fwrite(&header, sizeof (header), 1, file_);
+
+        writer_ = std::thread([this]() { run(); });
+    }
+
+    ~capture() {
+        stopping_ = true;
+        writer_.join();
+        drain();
+        std::fclose(file_);
+    }
+
+    capture(const capture &) = delete;
+    capture &operator=(const capture &) = delete;
+
+    std::uint64_t next_session_id() {
+        return next_session_id_++;
+    }
+
+    /* Records lost because a ring was full */
+    std::uint64_t dropped() const {
+        return dropped_;
+    }
+
+    void record(std::uint64_t session_id, message::opcode opcode,
+        const unsigned char *data, std::size_t length)
+    {
+        capture_record_header header;
+        header.timestamp = std::chrono::duration_cast<
+            std::chrono::nanoseconds>(std::chrono::system_clock::now()
+            .time_since_epoch()).count();
+        header.session_id = session_id;
+        header.original_length = static_cast<std::uint32_t>(length);
+        header.opcode = static_cast<std::uint8_t>(opcode);
+        header.reserved = 0;
+        header.reserved2 = 0;
+
+        std::uint64_t hash;
+        if (mode_ == capture_mode::hashes) {
+            hash = fnv1a(data, length);
+            data = reinterpret_cast<const unsigned char *>(&hash);
+            length = sizeof (hash);
+            header.flags = capture_flag_hashed;
+        } else {
+            header.flags = 0;
+        }
+        header.length = static_cast<std::uint32_t>(length);
+
+        if (!local_ring().push(header, data, length))
+            ++dropped_;
+    }
+
+private:
+    /* Single producer (the owning io thread), single consumer (the writer) */
+    class ring {
+    public:
+        explicit ring(std::size_t size) :
+            buffer_(size), head_(0), tail_(0) { }
+
+        bool push(const capture_record_header &header,
+            const unsigned char *data, std::size_t length)
+        {
+            static const unsigned char padding[8] = { 0 };
+            std::size_t padded = (length + 7) & ~std::size_t(7);
+            std::size_t needed = sizeof (header) + padded;
+
+            std::size_t head = head_.load(std::memory_order_relaxed);
+            std::size_t tail = tail_.load(std::memory_order_acquire);
+            if (buffer_.size() - (head - tail) < needed)
+                return false;
+
+            head = copy_in(head,
+                reinterpret_cast<const unsigned char *>(&header),
+                sizeof (header));
+            head = copy_in(head, data, length);
+            head = copy_in(head, padding, padded - length);
+            head_.store(head, std::memory_order_release);
+            return true;
+        }
+
+        /* Write everything published so far to file */
+        void drain(std::FILE *file) {
+            std::size_t tail = tail_.load(std::memory_order_relaxed);
+            std::size_t head = head_.load(std::memory_order_acquire);
+            while (tail != head) {
+                std::size_t offset = tail % buffer_.size();
+                std::size_t n = std::min(head - tail,
+                    buffer_.size() - offset);
+                std::fwrite(buffer_.data() + offset, 1, n, file);
+                tail += n;
+            }
+            tail_.store(tail, std::memory_order_release);
+        }
+
+    private:
+        std::vector<unsigned char> buffer_;
+        std::atomic<std::size_t> head_;
+        std::atomic<std::size_t> tail_;
+
+        std::size_t copy_in(std::size_t head, const unsigned char *data,
+            std::size_t length)
+        {
+            while (length) {
+                std::size_t offset = head % buffer_.size();
+                std::size_t n = std::min(length, buffer_.size() - offset);
+                std::memcpy(buffer_.data() + offset, data, n);
+                head += n;
+                data += n;
+                length -= n;
+            }
+            return head;
+        }
+    };
+
+    std::uint64_t id_;
+    capture_mode mode_;
+    std::size_t ring_size_;
+    std::atomic<std::uint64_t> next_session_id_;
+    std::atomic<std::uint64_t> dropped_;
+    std::atomic<bool> stopping_;
+    std::FILE *file_;
+    std::mutex rings_mutex_;
+    std::vector<std::shared_ptr<ring>> rings_;
+    std::thread writer_;
+
+    ring &local_ring() {
+        struct local {
+            std::uint64_t owner;
+            std::shared_ptr<ring> r;
+        };
+        /* One ring per capture this thread has recorded to, so threads
+         * switching between captures keep their rings */
+        static thread_local std::vector<local> rings;
+
+        for (auto &l : rings)
+            if (l.owner == id_)
+                return *l.r;
+
+        /* First record to this capture from this thread, only now is a lock
+         * taken. Rings only this thread still holds belong to destroyed
+         * captures. */
+        rings.erase(std::remove_if(rings.begin(), rings.end(),
+            [](const local &l) { return l.r.use_count() == 1; }),
+            rings.end());
+        auto r = std::make_shared<ring>(ring_size_);
+        {
+            std::lock_guard<std::mutex> lock(rings_mutex_);
+            rings_.push_back(r);
+        }
+        rings.push_back(local{ id_, r });
+        return *r;
+    }
+
+    /* Distinguishes captures that reuse the address of a destroyed one */
+    static std::uint64_t next_capture_id() {
+        static std::atomic<std::uint64_t> id(1);
+        return id++;
+    }
+
+    void drain() {
+        std::vector<std::shared_ptr<ring>> rings;
+        {
+            std::lock_guard<std::mutex> lock(rings_mutex_);
+            rings = rings_;
+        }
+        for (auto &r : rings)
+            r->drain(file_);
+    }
+
+    void run() {
+        while (!stopping_) {
+            drain();
+            std::fflush(file_);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+};
+
+} /* namespace ws */
+
+#endif /* WS_CAPTURE_HPP */
@@ -0,0 +1,71 @@
+#ifndef WS_FRAME_HPP
+#define WS_FRAME_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <boost/asio/buffer.hpp>
+#include "message.hpp"
+
+namespace ws {
+
+/* An encoded, immutable websocket frame (header followed by payload). Frames
+ * are reference counted so the same bytes can be queued on many sessions
+ * without being copied or re-encoded. */
+typedef std::vector<unsigned char> frame;
+typedef std::shared_ptr<const frame> frame_ptr;
+
+/* Largest possible unmasked frame header */
+const std::size_t max_frame_header_length = 10;
+
+/* Write an unmasked frame header for a payload of payload_length bytes into
+ * header, returning the number of bytes used */
+inline std::size_t encode_frame_header(message::opcode opcode,
+    std::uint64_t payload_length,
+    std::array<unsigned char, max_frame_header_length> &header,
+    bool fin = true)
+{
+    /* FIN bit and opcode */
+    header[0] = (fin ? 0x80 : 0x00) | static_cast<unsigned char>(opcode);
+
+    /* Payload length (mask bit is always 0) */
+    if (payload_length < 126) {
+        header[1] = static_cast<unsigned char>(payload_length);
+        return 2;
+    } else if (payload_length < 65536) {
+        header[1] = 126;
+        header[2] = (payload_length >> 8) & 0xff;
+        header[3] = payload_length & 0xff;
+        return 4;
+    }
+
+    header[1] = 127;
+    for (std::size_t i = 0; i < 8; ++i)
+        header[2 + i] = (payload_length >> (56 - 8 * i)) & 0xff;
+    return 10;
+}
+
+/* Encode a complete frame once so it can be shared between sessions */
+inline frame_ptr make_frame(message::opcode opcode,
+    const boost::asio::const_buffer &buffer, bool fin = true)
+{
+    std::size_t payload_length = boost::asio::buffer_size(buffer);
+    const unsigned char *payload =
+        boost::asio::buffer_cast<const unsigned char *>(buffer);
+
+    std::array<unsigned char, max_frame_header_length> header;
+    std::size_t header_length = encode_frame_header(opcode, payload_length,
+        header, fin);
+
+    auto f = std::make_shared<frame>(header_length + payload_length);
+    std::memcpy(f->data(), header.data(), header_length);
+    if (payload_length)
+        std::memcpy(f->data() + header_length, payload, payload_length);
+    return f;
+}
+
+} /* namespace ws */
+
+#endif /* WS_FRAME_HPP */
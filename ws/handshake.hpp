@@ -0,0 +1,160 @@
+#ifndef WS_HANDSHAKE_HPP
+#define WS_HANDSHAKE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace ws {
+
+/* Caps the number of opening handshakes in progress across all sessions
+ * that share it, so that clients trickling in their requests can't hold an
+ * unbounded number of sessions and buffers. With max_per_address, no single
+ * peer address may hold more than that many of them, so one host trickling
+ * requests can't take every slot from the others. Sessions over either cap
+ * are answered 503 straight away. Must outlive the sessions using it. */
+class handshake_limiter {
+public:
+    /* A max_per_address of 0 caps only the total */
+    explicit handshake_limiter(std::size_t max_in_progress,
+        std::size_t max_per_address = 0) :
+        max_(max_in_progress), max_per_address_(max_per_address),
+        in_progress_(0) { }
+
+    handshake_limiter(const handshake_limiter &) = delete;
+    handshake_limiter &operator=(const handshake_limiter &) = delete;
+
+    bool try_acquire(const std::string &address = std::string()) {
+        if (max_per_address_) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::size_t &n = per_address_[address];
+            if (n >= max_per_address_ || !acquire()) {
+                if (!n)
+                    per_address_.erase(address);
+                return false;
+            }
+            ++n;
+            return true;
+        }
+        return acquire();
+    }
+
+    /* address must be the one passed to try_acquire() */
+    void release(const std::string &address = std::string()) {
+        if (max_per_address_) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = per_address_.find(address);
+            if (it != per_address_.end() && --it->second == 0)
+                per_address_.erase(it);
+        }
+        --in_progress_;
+    }
+
+    std::size_t in_progress() const {
+        return in_progress_;
+    }
+
+    /* Whether handshakes are counted per peer address too */
+    bool per_address() const {
+        return max_per_address_ != 0;
+    }
+
+private:
+    const std::size_t max_;
+    const std::size_t max_per_address_;
+    std::atomic<std::size_t> in_progress_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::size_t> per_address_;
+
+    bool acquire() {
+        std::size_t n = in_progress_.load();
+        do {
+            if (n >= max_)
+                return false;
+        } while (!in_progress_.compare_exchange_weak(n, n + 1));
+        return true;
+    }
+};
+
+namespace detail {
+
+/* Responses to rejected handshakes, built once so that turning a client
+ * away costs no formatting or allocation */
+inline const std::string &bad_request_response() {
+    static const std::string response =
+        "HTTP/1.1 400 Bad Request\r\n"
+        "Connection: close\r\n"
+        "Content-Length: 0\r\n\r\n";
+    return response;
+}
+
+inline const std::string &header_too_large_response() {
+    static const std::string response =
+        "HTTP/1.1 431 Request Header Fields Too Large\r\n"
+        "Connection: close\r\n"
+        "Content-Length: 0\r\n\r\n";
+    return response;
+}
+
+inline const std::string &upgrade_required_response() {
+    static const std::string response =
+        "HTTP/1.1 426 Upgrade Required\r\n"
+        "Sec-WebSocket-Version: 13\r\n"
+        "Connection: close\r\n"
+        "Content-Length: 0\r\n\r\n";
+    return response;
+}
+
+inline const std::string &service_unavailable_response() {
+    static const std::string response =
+        "HTTP/1.1 503 Service Unavailable\r\n"
+        "Connection: close\r\n"
+        "Retry-After: 1\r\n"
+        "Content-Length: 0\r\n\r\n";
+    return response;
+}
+
+inline bool iequals(const std::string &a, const std::string &b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(),
+        [](char x, char y) {
+            return std::tolower(static_cast<unsigned char>(x)) ==
+                std::tolower(static_cast<unsigned char>(y));
+        });
+}
+
+/* Whether the comma separated header value holds token, ignoring case */
+inline bool has_token(const std::string &value, const std::string &token) {
+    std::size_t begin = 0;
+    for (;;) {
+        std::size_t end = std::min(value.find(',', begin), value.size());
+        std::string item = value.substr(begin, end - begin);
+        std::size_t first = item.find_first_not_of(" \t");
+        if (first != std::string::npos &&
+            iequals(item.substr(first,
+                item.find_last_not_of(" \t") - first + 1), token))
+        {
+            return true;
+        }
+        if (end == value.size())
+            return false;
+        begin = end + 1;
+    }
+}
+
+/* Value of the header name, whatever its case, or nullptr */
+template <typename Map>
+const std::string *find_header(const Map &headers, const std::string &name) {
+    for (auto &kv : headers)
+        if (iequals(kv.first, name))
+            return &kv.second;
+    return nullptr;
+}
+
+} /* namespace detail */
+
+} /* namespace ws */
+
+#endif /* WS_HANDSHAKE_HPP */
@@ -0,0 +1,73 @@
+#ifndef WS_HISTORY_HPP
+#define WS_HISTORY_HPP
+
+#include <cstdint>
+#include <vector>
+#include "frame.hpp"
+
+namespace ws {
+
+/* Fixed-capacity ring of pre-encoded frames. Every pushed frame is given a
+ * sequence number (starting at 1) so that a reconnecting peer can be sent
+ * only the frames it has not seen yet. */
+class history {
+public:
+    explicit history(std::size_t capacity) :
+        ring_(capacity), next_sequence_(1) { }
+
+    /* Append a frame, evicting the oldest if full. Returns its sequence
+     * number. */
+    std::uint64_t push(frame_ptr f) {
+        std::uint64_t sequence = next_sequence_++;
+        if (!ring_.empty())
+            ring_[slot(sequence)] = std::move(f);
+        return sequence;
+    }
+
+    /* All retained frames with a sequence number greater than sequence, oldest
+     * first. since(0) returns the whole backlog. */
+    std::vector<frame_ptr> since(std::uint64_t sequence) const {
+        std::vector<frame_ptr> frames;
+        std::uint64_t first = first_sequence();
+        if (sequence + 1 > first)
+            first = sequence + 1;
+        if (first >= next_sequence_)
+            return frames;
+
+        frames.reserve(next_sequence_ - first);
+        for (std::uint64_t s = first; s < next_sequence_; ++s)
+            frames.push_back(ring_[slot(s)]);
+        return frames;
+    }
+
+    /* Sequence number of the newest frame, 0 if nothing has been pushed */
+    std::uint64_t last_sequence() const {
+        return next_sequence_ - 1;
+    }
+
+    std::size_t size() const {
+        return next_sequence_ - first_sequence();
+    }
+
+    std::size_t capacity() const {
+        return ring_.size();
+    }
+
+private:
+    std::vector<frame_ptr> ring_;
+    std::uint64_t next_sequence_;
+
+    std::uint64_t first_sequence() const {
+        if (next_sequence_ - 1 < ring_.size())
+            return 1;
+        return next_sequence_ - ring_.size();
+    }
+
+    std::size_t slot(std::uint64_t sequence) const {
+        return (sequence - 1) % ring_.size();
+    }
+};
+
+} /* namespace ws */
+
+#endif /* WS_HISTORY_HPP */
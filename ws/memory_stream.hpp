@@ -0,0 +1,287 @@
+#ifndef WS_MEMORY_STREAM_HPP
+#define WS_MEMORY_STREAM_HPP
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <boost/asio.hpp>
+#include "session.hpp"
+
+namespace ws {
+
+/* One end of an in-process duplex byte stream, for running sessions without
+ * the kernel (benchmarks, tests). Two ends are joined with connect(); bytes
+ * written to one are read from the other. A chunk size other than 0 caps
+ * what each read_some/write_some transfers, to exercise partial reads and
+ * writes. Both ends must be used from the thread running their io_service;
+ * completions are always posted, never run inline. */
+class memory_stream {
+public:
+    typedef boost::asio::io_service::executor_type executor_type;
+    typedef memory_stream lowest_layer_type;
+
+    explicit memory_stream(boost::asio::io_service &io_service,
+        std::size_t chunk_size = 0) :
+        io_service_(io_service), chunk_size_(chunk_size) { }
+
+    memory_stream(const memory_stream &) = delete;
+    memory_stream &operator=(const memory_stream &) = delete;
+
+    ~memory_stream() {
+        boost::system::error_code ignored;
+        close(ignored);
+    }
+
+    static void connect(memory_stream &a, memory_stream &b) {
+        a.in_ = b.out_ = std::make_shared<pipe>();
+        a.out_ = b.in_ = std::make_shared<pipe>();
+    }
+
+    executor_type get_executor() {
+        return io_service_.get_executor();
+    }
+
+    lowest_layer_type &lowest_layer() {
+        return *this;
+    }
+
+    void set_chunk_size(std::size_t chunk_size) {
+        chunk_size_ = chunk_size;
+    }
+
+    bool is_open() const {
+        return in_ && !in_->reader_closed;
+    }
+
+    /* Pending operations on this end are aborted, the peer reads end of
+     * file once it has drained what was written */
+    void close(boost::system::error_code &ec) {
+        ec = boost::system::error_code();
+        if (!in_ || in_->reader_closed)
+            return;
+
+        in_->reader_closed = true;
+        wake(*in_);
+        out_->writer_closed = true;
+        wake(*out_);
+    }
+
+    void close() {
+        boost::system::error_code ec;
+        close(ec);
+    }
+
+    template <typename MutableBufferSequence, typename ReadHandler>
+    void async_read_some(const MutableBufferSequence &buffers,
+        ReadHandler &&handler)
+    {
+        typedef typename std::decay<ReadHandler>::type handler_type;
+
+        if (!in_ || in_->ready() || !boost::asio::buffer_size(buffers)) {
+            complete_read(io_service_, in_.get(), buffers, chunk_size_,
+                std::forward<ReadHandler>(handler));
+            return;
+        }
+
+        /* Wait for the writer, the handler has to become copyable */
+        auto h = std::make_shared<handler_type>(
+            std::forward<ReadHandler>(handler));
+        auto in = in_;
+        std::size_t chunk_size = chunk_size_;
+        boost::asio::io_service &io_service = io_service_;
+        in_->waiter = [&io_service, in, buffers, chunk_size, h]() {
+            complete_read(io_service, in.get(), buffers, chunk_size,
+                shared_handler<handler_type>{h});
+        };
+    }
+
+    template <typename ConstBufferSequence, typename WriteHandler>
+    void async_write_some(const ConstBufferSequence &buffers,
+        WriteHandler &&handler)
+    {
+        boost::system::error_code ec;
+        std::size_t n = 0;
+        if (!out_ || out_->writer_closed) {
+            ec = boost::asio::error::bad_descriptor;
+        } else if (out_->reader_closed) {
+            ec = boost::asio::error::broken_pipe;
+        } else {
+            std::size_t length = boost::asio::buffer_size(buffers);
+            if (chunk_size_)
+                length = std::min(length, chunk_size_);
+
+            std::size_t end = out_->data.size();
+            out_->data.resize(end + length);
+            n = boost::asio::buffer_copy(
+                boost::asio::buffer(out_->data.data() + end, length),
+                buffers);
+            wake(*out_);
+        }
+
+        boost::asio::post(io_service_, bound_handler<
+            typename std::decay<WriteHandler>::type>(
+            std::forward<WriteHandler>(handler), ec, n));
+    }
+
+    /* Readiness, as for a socket: reading completes once there is data or
+     * end of file, writing straight away */
+    template <typename WaitHandler>
+    void async_wait(boost::asio::socket_base::wait_type type,
+        WaitHandler &&handler)
+    {
+        typedef typename std::decay<WaitHandler>::type handler_type;
+
+        if (type != boost::asio::socket_base::wait_read || !in_ ||
+            in_->ready())
+        {
+            complete_wait(io_service_, in_.get(),
+                std::forward<WaitHandler>(handler));
+            return;
+        }
+
+        auto h = std::make_shared<handler_type>(
+            std::forward<WaitHandler>(handler));
+        auto in = in_;
+        boost::asio::io_service &io_service = io_service_;
+        in_->waiter = [&io_service, in, h]() {
+            complete_wait(io_service, in.get(),
+                shared_handler<handler_type>{h});
+        };
+    }
+
+private:
+    /* Bytes travelling in one direction */
+    struct pipe {
+        pipe() : offset(0), reader_closed(false), writer_closed(false) { }
+
+        std::vector<unsigned char> data;
+        std::size_t offset;
+        bool reader_closed;
+        bool writer_closed;
+        /* The reading end's pending read or wait */
+        std::function<void()> waiter;
+
+        std::size_t available() const {
+            return data.size() - offset;
+        }
+
+        bool ready() const {
+            return available() || reader_closed || writer_closed;
+        }
+
+        void consume(std::size_t n) {
+            offset += n;
+            if (offset == data.size()) {
+                data.clear();
+                offset = 0;
+            } else if (offset > data.size() / 2) {
+                data.erase(data.begin(), data.begin() + offset);
+                offset = 0;
+            }
+        }
+    };
+
+    boost::asio::io_service &io_service_;
+    std::size_t chunk_size_;
+    std::shared_ptr<pipe> in_;
+    std::shared_ptr<pipe> out_;
+
+    /* Handler with its result, posted without further allocation */
+    template <typename Handler>
+    struct bound_handler {
+        template <typename H>
+        bound_handler(H &&h, const boost::system::error_code &e,
+            std::size_t count) :
+            handler(std::forward<H>(h)), ec(e), n(count) { }
+
+        void operator()() {
+            handler(ec, n);
+        }
+
+        Handler handler;
+        boost::system::error_code ec;
+        std::size_t n;
+    };
+
+    template <typename Handler>
+    struct bound_wait_handler {
+        void operator()() {
+            handler(ec);
+        }
+
+        Handler handler;
+        boost::system::error_code ec;
+    };
+
+    /* Invokes a handler kept alive by a waiting operation */
+    template <typename Handler>
+    struct shared_handler {
+        template <typename... Args>
+        void operator()(Args &&... args) {
+            (*h)(std::forward<Args>(args)...);
+        }
+
+        std::shared_ptr<Handler> h;
+    };
+
+    template <typename MutableBufferSequence, typename ReadHandler>
+    static void complete_read(boost::asio::io_service &io_service, pipe *in,
+        const MutableBufferSequence &buffers, std::size_t chunk_size,
+        ReadHandler &&handler)
+    {
+        boost::system::error_code ec;
+        std::size_t n = 0;
+        if (!in || in->reader_closed) {
+            ec = boost::asio::error::operation_aborted;
+        } else if (in->available()) {
+            std::size_t length = in->available();
+            if (chunk_size)
+                length = std::min(length, chunk_size);
+            n = boost::asio::buffer_copy(buffers, boost::asio::buffer(
+                in->data.data() + in->offset, length));
+            in->consume(n);
+        } else if (in->writer_closed && boost::asio::buffer_size(buffers)) {
+            ec = boost::asio::error::eof;
+        }
+
+        boost::asio::post(io_service, bound_handler<
+            typename std::decay<ReadHandler>::type>(
+            std::forward<ReadHandler>(handler), ec, n));
+    }
+
+    template <typename WaitHandler>
+    static void complete_wait(boost::asio::io_service &io_service, pipe *in,
+        WaitHandler &&handler)
+    {
+        boost::system::error_code ec;
+        if (!in || in->reader_closed)
+            ec = boost::asio::error::operation_aborted;
+
+        boost::asio::post(io_service,
+            bound_wait_handler<typename std::decay<WaitHandler>::type>{
+            std::forward<WaitHandler>(handler), ec});
+    }
+
+    static void wake(pipe &p) {
+        if (p.waiter) {
+            std::function<void()> waiter;
+            waiter.swap(p.waiter);
+            waiter();
+        }
+    }
+};
+
+template <>
+struct stream_traits<memory_stream> {
+    static const bool coalesce_writes = false;
+    static const bool readiness_reads = true;
+    /* There is no descriptor to sendfile() to */
+    static const bool sendfile = false;
+};
+
+} /* namespace ws */
+
+#endif /* WS_MEMORY_STREAM_HPP */
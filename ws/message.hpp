@@ -1,10 +1,115 @@
 #ifndef WS_MESSAGE_HPP
 #define WS_MESSAGE_HPP
 
+#include <cstring>
+#include <type_traits>
 #include <vector>
+#include "pool.hpp"
 
 namespace ws {
 
+/* Message payload bytes. Payloads of up to inline_capacity bytes are stored
+ * in the object itself, larger ones come from the per-thread buffer_pool. */
+class payload {
+public:
+    enum { inline_capacity = 64 };
+
+    typedef unsigned char value_type;
+    typedef const unsigned char *const_iterator;
+    typedef unsigned char *iterator;
+
+    explicit payload(std::size_t size = 0) : size_(0), capacity_(0),
+        data_(inline_) { resize(size); }
+
+    payload(const unsigned char *data, std::size_t size) : payload(size) {
+        if (size)
+            std::memcpy(data_, data, size);
+    }
+
+    payload(const payload &other) : payload(other.data_, other.size_) { }
+
+    /* noexcept so that containers of messages move them when they grow */
+    payload(payload &&other) noexcept :
+        size_(0), capacity_(0), data_(inline_)
+    {
+        steal(other);
+    }
+
+    payload &operator=(const payload &other) {
+        if (this != &other) {
+            resize(other.size_);
+            if (size_)
+                std::memcpy(data_, other.data_, size_);
+        }
+        return *this;
+    }
+
+    payload &operator=(payload &&other) noexcept {
+        if (this != &other) {
+            release();
+            steal(other);
+        }
+        return *this;
+    }
+
+    ~payload() {
+        release();
+    }
+
+    /* Contents are not preserved when the payload has to grow */
+    void resize(std::size_t size) {
+        if (size > inline_capacity && size > capacity_) {
+            release();
+            data_ = buffer_pool::allocate(size, capacity_);
+        }
+        size_ = size;
+    }
+
+    unsigned char *data() { return data_; }
+    const unsigned char *data() const { return data_; }
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    iterator begin() { return data_; }
+    iterator end() { return data_ + size_; }
+    const_iterator begin() const { return data_; }
+    const_iterator end() const { return data_ + size_; }
+
+    unsigned char &operator[](std::size_t i) { return data_[i]; }
+    const unsigned char &operator[](std::size_t i) const { return data_[i]; }
+
+private:
+    std::size_t size_;
+    /* Capacity of the pooled buffer, 0 while inline */
+    std::size_t capacity_;
+    unsigned char *data_;
+    unsigned char inline_[inline_capacity];
+
+    void release() {
+        if (data_ != inline_)
+            buffer_pool::deallocate(data_, capacity_);
+        data_ = inline_;
+        capacity_ = 0;
+        size_ = 0;
+    }
+
+    void steal(payload &other) {
+        /* The size test is implied by the other, it lets the compiler see
+         * that the copy stays within inline_ */
+        if (other.size_ <= inline_capacity && other.data_ == other.inline_) {
+            size_ = other.size_;
+            std::memcpy(inline_, other.inline_, size_);
+        } else {
+            data_ = other.data_;
+            size_ = other.size_;
+            capacity_ = other.capacity_;
+            other.data_ = other.inline_;
+            other.capacity_ = 0;
+        }
+        other.size_ = 0;
+    }
+};
+
 class message {
 public:
     enum class opcode {
@@ -18,8 +123,11 @@ public:
         pong = 0x0a
     };
 
-    message(opcode op, std::vector<unsigned char> payload) :
-        opcode_(op), payload_(std::move(payload)) { }
+    message(opcode op, std::size_t payload_length) :
+        opcode_(op), payload_(payload_length) { }
+
+    message(opcode op, const std::vector<unsigned char> &payload) :
+        opcode_(op), payload_(payload.data(), payload.size()) { }
 
     opcode get_opcode() const {
         return opcode_;
@@ -29,14 +137,22 @@ public:
         opcode_ = op;
     }
 
-    const std::vector<unsigned char> &get_payload() const {
+    const ws::payload &get_payload() const {
+        return payload_;
+    }
+
+    ws::payload &get_payload() {
         return payload_;
     }
 private:
     opcode opcode_;
-    std::vector<unsigned char> payload_;
+    ws::payload payload_;
 };
 
+static_assert(std::is_nothrow_move_constructible<message>::value &&
+    std::is_nothrow_move_assignable<message>::value,
+    "messages must move without copying their payloads");
+
 } /* namespace ws */
 
 #endif /* WS_MESSAGE_HPP */
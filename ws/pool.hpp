@@ -0,0 +1,141 @@
+#ifndef WS_POOL_HPP
+#define WS_POOL_HPP
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <boost/asio/streambuf.hpp>
+
+namespace ws {
+
+/* Per-thread pool of payload buffers in power-of-two size classes. Buffers
+ * larger than the biggest class go straight to the heap. A buffer may be
+ * released on a different thread to the one that allocated it, it then
+ * simply joins that thread's pool. */
+class buffer_pool {
+public:
+    enum {
+        min_class_size = 128,
+        max_class_size = 64 * 1024,
+        /* Cached buffers per size class, beyond this they are freed */
+        max_cached = 64
+    };
+
+    /* Allocate at least size bytes, capacity is set to the usable size which
+     * must be passed back to deallocate() */
+    static unsigned char *allocate(std::size_t size, std::size_t &capacity) {
+        std::size_t index = class_index(size);
+        if (index == npos) {
+            capacity = size;
+            return new unsigned char[size];
+        }
+
+        capacity = class_size(index);
+        std::vector<unsigned char *> &free_list = local().free_lists_[index];
+        if (free_list.empty())
+            return new unsigned char[capacity];
+
+        unsigned char *p = free_list.back();
+        free_list.pop_back();
+        return p;
+    }
+
+    static void deallocate(unsigned char *p, std::size_t capacity) {
+        std::size_t index = class_index(capacity);
+        if (index == npos || class_size(index) != capacity) {
+            delete[] p;
+            return;
+        }
+
+        std::vector<unsigned char *> &free_list = local().free_lists_[index];
+        if (free_list.size() >= max_cached) {
+            delete[] p;
+            return;
+        }
+        free_list.push_back(p);
+    }
+
+private:
+    enum { class_count = 10 }; /* 128 bytes to 64 KiB */
+    static const std::size_t npos = static_cast<std::size_t>(-1);
+
+    std::array<std::vector<unsigned char *>, class_count> free_lists_;
+
+    /* Room for every cached buffer up front, so deallocate() never
+     * allocates and payloads can free their buffers in noexcept moves */
+    buffer_pool() {
+        for (auto &free_list : free_lists_)
+            free_list.reserve(max_cached);
+    }
+    buffer_pool(const buffer_pool &) = delete;
+    buffer_pool &operator=(const buffer_pool &) = delete;
+
+    ~buffer_pool() {
+        for (auto &free_list : free_lists_)
+            for (auto p : free_list)
+                delete[] p;
+    }
+
+    static buffer_pool &local() {
+        static thread_local buffer_pool pool;
+        return pool;
+    }
+
+    static std::size_t class_size(std::size_t index) {
+        return static_cast<std::size_t>(min_class_size) << index;
+    }
+
+    static std::size_t class_index(std::size_t size) {
+        if (size > max_class_size)
+            return npos;
+        std::size_t index = 0;
+        while (class_size(index) < size)
+            ++index;
+        return index;
+    }
+};
+
+/* Per-thread pool of receive buffers, lent to sessions only while they are
+ * decoding frames so that idle connections hold no receive memory */
+class streambuf_pool {
+public:
+    typedef std::unique_ptr<boost::asio::streambuf> pointer;
+
+    enum {
+        /* Buffers grown beyond this are freed rather than cached */
+        max_cached_capacity = 64 * 1024,
+        max_cached = 256
+    };
+
+    static pointer acquire() {
+        std::vector<pointer> &free_list = local();
+        if (free_list.empty())
+            return pointer(new boost::asio::streambuf);
+
+        pointer buffer = std::move(free_list.back());
+        free_list.pop_back();
+        return buffer;
+    }
+
+    /* Return an empty buffer to the pool */
+    static void release(pointer buffer) {
+        std::vector<pointer> &free_list = local();
+        if (buffer && buffer->size() == 0 &&
+            buffer->capacity() <= max_cached_capacity &&
+            free_list.size() < max_cached)
+        {
+            free_list.push_back(std::move(buffer));
+        }
+    }
+
+private:
+    static std::vector<pointer> &local() {
+        static thread_local std::vector<pointer> free_list;
+        return free_list;
+    }
+};
+
+} /* namespace ws */
+
+#endif /* WS_POOL_HPP */
@@ -0,0 +1,142 @@
+#ifndef WS_RATE_LIMIT_HPP
+#define WS_RATE_LIMIT_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace ws {
+
+/* Inbound limits, a rate of 0 means unlimited. Bursts default to one
+ * second's worth of the rate. */
+struct rate_limits {
+    rate_limits() : messages_per_second(0), message_burst(0),
+        bytes_per_second(0), byte_burst(0) { }
+
+    double messages_per_second;
+    double message_burst;
+    double bytes_per_second;
+    double byte_burst;
+};
+
+/* Token bucket that may be overdrawn, in which case the owner waits for it
+ * to refill rather than dropping what has already arrived */
+class token_bucket {
+public:
+    typedef std::chrono::steady_clock clock;
+
+    token_bucket(double rate, double burst) :
+        rate_(rate), burst_(burst > 0 ? burst : rate), tokens_(burst_),
+        last_(clock::now()) { }
+
+    void consume(double tokens, clock::time_point now) {
+        if (rate_ <= 0)
+            return;
+        refill(now);
+        tokens_ -= tokens;
+    }
+
+    /* Time until the bucket is no longer overdrawn */
+    clock::duration delay(clock::time_point now) {
+        if (rate_ <= 0)
+            return clock::duration::zero();
+        refill(now);
+        if (tokens_ >= 0)
+            return clock::duration::zero();
+        return std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double>(-tokens_ / rate_));
+    }
+
+private:
+    double rate_;
+    double burst_;
+    double tokens_;
+    clock::time_point last_;
+
+    void refill(clock::time_point now) {
+        std::chrono::duration<double> elapsed = now - last_;
+        last_ = now;
+        tokens_ = std::min(burst_, tokens_ + elapsed.count() * rate_);
+    }
+};
+
+/* Message and byte buckets for one session or, shared between sessions, for
+ * one remote address */
+class rate_limiter {
+public:
+    typedef token_bucket::clock clock;
+
+    explicit rate_limiter(const rate_limits &limits) :
+        messages_(limits.messages_per_second, limits.message_burst),
+        bytes_(limits.bytes_per_second, limits.byte_burst) { }
+
+    void consume(std::size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        clock::time_point now = clock::now();
+        messages_.consume(1, now);
+        bytes_.consume(static_cast<double>(bytes), now);
+    }
+
+    clock::duration delay() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        clock::time_point now = clock::now();
+        return std::max(messages_.delay(now), bytes_.delay(now));
+    }
+
+private:
+    std::mutex mutex_;
+    token_bucket messages_;
+    token_bucket bytes_;
+};
+
+/* Hands out one rate_limiter per remote address so that all sessions from
+ * that address draw from the same budget. Limiters are dropped once the last
+ * session using them has gone. */
+class address_rate_limiter {
+public:
+    explicit address_rate_limiter(const rate_limits &limits) :
+        limits_(limits), prune_at_(min_prune_size) { }
+
+    std::shared_ptr<rate_limiter> get(const std::string &address) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        std::weak_ptr<rate_limiter> &entry = limiters_[address];
+        std::shared_ptr<rate_limiter> limiter = entry.lock();
+        if (!limiter) {
+            limiter = std::make_shared<rate_limiter>(limits_);
+            entry = limiter;
+        }
+
+        if (limiters_.size() > prune_at_) {
+            prune();
+            prune_at_ = std::max<std::size_t>(min_prune_size,
+                2 * limiters_.size());
+        }
+        return limiter;
+    }
+
+private:
+    enum { min_prune_size = 64 };
+
+    rate_limits limits_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::weak_ptr<rate_limiter>> limiters_;
+    /* Expired entries are swept once the map grows past this */
+    std::size_t prune_at_;
+
+    void prune() {
+        for (auto it = limiters_.begin(); it != limiters_.end();) {
+            if (it->second.expired())
+                it = limiters_.erase(it);
+            else
+                ++it;
+        }
+    }
+};
+
+} /* namespace ws */
+
+#endif /* WS_RATE_LIMIT_HPP */
@@ -0,0 +1,291 @@
+#ifndef WS_REGISTRY_HPP
+#define WS_REGISTRY_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <boost/asio.hpp>
+#include "frame.hpp"
+
+namespace ws {
+
+namespace detail {
+
+/* Unbounded lock-free multi-producer single-consumer queue (Vyukov). push()
+ * is wait-free and safe from any thread; pop() must only be called by one
+ * thread at a time. */
+template <typename T>
+class mpsc_queue {
+public:
+    mpsc_queue() : head_(new node), tail_(head_.load()) { }
+
+    ~mpsc_queue() {
+        T value;
+        while (pop(value))
+            ;
+        delete tail_;
+    }
+
+    mpsc_queue(const mpsc_queue &) = delete;
+    mpsc_queue &operator=(const mpsc_queue &) = delete;
+
+    void push(T value) {
+        node *n = new node;
+        n->value = std::move(value);
+        node *prev = head_.exchange(n, std::memory_order_acq_rel);
+        prev->next.store(n, std::memory_order_release);
+    }
+
+    /* False when empty, or when the next push is still being linked in (its
+     * producer then schedules another pop) */
+    bool pop(T &value) {
+        node *next = tail_->next.load(std::memory_order_acquire);
+        if (!next)
+            return false;
+
+        /* next becomes the new stub */
+        value = std::move(next->value);
+        delete tail_;
+        tail_ = next;
+        return true;
+    }
+
+private:
+    struct node {
+        node() : next(nullptr) { }
+        std::atomic<node *> next;
+        T value;
+    };
+
+    std::atomic<node *> head_;
+    node *tail_;
+};
+
+} /* namespace detail */
+
+/* Sessions by stable id, sharded per io_service (one per io thread).
+ *
+ * An id encodes its shard, a slot and the slot's generation, so lookup is an
+ * index and an id never refers to a later session that reuses the slot: a
+ * slot whose generations are used up is retired rather than reused. Each
+ * shard holds up to max_slots sessions at once. A session is only held
+ * weakly, so one that goes without remove(), e.g. after on_error() or a
+ * dropped connection, has its slot reclaimed by a later add() once the
+ * shard's slots have doubled since the last sweep for them.
+ * add() and find() touch only the owning shard and must run on its io
+ * thread, typically from on_open(). remove() may be called from any thread,
+ * e.g. from on_close() on a worker pool: the slot is released on the owning
+ * thread, at once if called from within its io_service's run(). send_to()
+ * may be called from any thread: the frame is pushed onto the owning shard's
+ * lock-free queue, which is drained in batches on the owning thread, where
+ * it is handed to Session::send(). Frames for sessions that have gone are
+ * dropped.
+ *
+ * The registry must outlive the io_services' run(). */
+template <typename Session>
+class registry {
+public:
+    typedef std::uint64_t id_type;
+
+    /* Never returned by add() */
+    static const id_type invalid_id = 0;
+
+    explicit registry(const std::vector<boost::asio::io_service *> &shards,
+        std::size_t max_batch = default_max_batch) :
+        max_batch_(max_batch)
+    {
+        if (shards.empty() || shards.size() > max_shards)
+            throw std::invalid_argument("ws::registry: bad shard count");
+
+        for (auto io_service : shards)
+            shards_.emplace_back(new shard(*io_service));
+    }
+
+    registry(const registry &) = delete;
+    registry &operator=(const registry &) = delete;
+
+    /* Register session, which runs on owner */
+    id_type add(boost::asio::io_service &owner,
+        const std::shared_ptr<Session> &session)
+    {
+        std::size_t index = shard_index(owner);
+        shard &s = *shards_[index];
+
+        /* Sweeping only once the slots have doubled keeps add() amortized
+         * constant time, however many sessions went without remove() */
+        if (s.free.empty() && s.slots.size() >= s.next_sweep) {
+            reclaim(s);
+            s.next_sweep = std::min<std::size_t>(2 * s.slots.size(),
+                max_slots);
+        }
+
+        std::uint32_t slot;
+        if (!s.free.empty()) {
+            slot = s.free.back();
+            s.free.pop_back();
+        } else {
+            if (s.slots.size() >= max_slots)
+                throw std::length_error("ws::registry: shard is full");
+            slot = static_cast<std::uint32_t>(s.slots.size());
+            s.slots.emplace_back();
+        }
+        s.slots[slot].session = session;
+        s.slots[slot].used = true;
+        return make_id(index, s.slots[slot].generation, slot);
+    }
+
+    void remove(id_type id) {
+        std::size_t index = id >> 48;
+        if (index >= shards_.size())
+            return;
+
+        boost::asio::dispatch(shards_[index]->io_service, [this, id]() {
+            shard *s;
+            std::uint32_t slot;
+            if (locate(id, s, slot) && s->slots[slot].used)
+                release(*s, slot);
+        });
+    }
+
+    std::shared_ptr<Session> find(id_type id) const {
+        shard *s;
+        std::uint32_t slot;
+        if (!locate(id, s, slot))
+            return nullptr;
+        return s->slots[slot].session.lock();
+    }
+
+    /* Queue frame for the session id on its own io thread */
+    void send_to(id_type id, frame_ptr frame) {
+        std::size_t index = id >> 48;
+        if (index >= shards_.size())
+            return;
+
+        shard &s = *shards_[index];
+        s.queue.push(entry{id, std::move(frame)});
+        schedule(s);
+    }
+
+private:
+    enum {
+        default_max_batch = 256,
+        max_shards = 1 << 16,
+        max_slots = 1 << 24,
+        max_generation = (1 << 24) - 1,
+        /* Slots a shard may grow to before add() first reclaims any */
+        min_sweep = 1024
+    };
+
+    struct slot_type {
+        slot_type() : generation(1), used(false) { }
+        std::weak_ptr<Session> session;
+        /* Never 0, so no id is invalid_id */
+        std::uint32_t generation;
+        /* Holds a session that hasn't been removed, false while the slot is
+         * free or retired */
+        bool used;
+    };
+
+    struct entry {
+        id_type id;
+        frame_ptr frame;
+    };
+
+    struct shard {
+        explicit shard(boost::asio::io_service &io) :
+            io_service(io), next_sweep(min_sweep), scheduled(false) { }
+
+        boost::asio::io_service &io_service;
+        /* Owning thread only */
+        std::vector<slot_type> slots;
+        std::vector<std::uint32_t> free;
+        std::size_t next_sweep;
+        /* Any thread */
+        detail::mpsc_queue<entry> queue;
+        std::atomic<bool> scheduled;
+    };
+
+    std::vector<std::unique_ptr<shard>> shards_;
+    std::size_t max_batch_;
+
+    /* 16 bits shard, 24 bits generation, 24 bits slot */
+    static id_type make_id(std::size_t shard, std::uint32_t generation,
+        std::uint32_t slot)
+    {
+        return static_cast<id_type>(shard) << 48 |
+            static_cast<id_type>(generation) << 24 | slot;
+    }
+
+    bool locate(id_type id, shard *&s, std::uint32_t &slot) const {
+        std::size_t index = id >> 48;
+        if (index >= shards_.size())
+            return false;
+
+        s = shards_[index].get();
+        slot = static_cast<std::uint32_t>(id & (max_slots - 1));
+        return slot < s->slots.size() &&
+            s->slots[slot].generation == ((id >> 24) & max_generation);
+    }
+
+    /* Owning thread only: the slot's id stops matching and, unless its
+     * generations are used up, the slot can be reused */
+    void release(shard &s, std::uint32_t slot) {
+        slot_type &t = s.slots[slot];
+        t.session.reset();
+        t.used = false;
+        if (t.generation == max_generation)
+            return;
+        ++t.generation;
+        s.free.push_back(slot);
+    }
+
+    /* Release the slots of sessions that have gone without remove() */
+    void reclaim(shard &s) {
+        for (std::size_t i = 0; i < s.slots.size(); ++i) {
+            if (s.slots[i].used && s.slots[i].session.expired())
+                release(s, static_cast<std::uint32_t>(i));
+        }
+    }
+
+    std::size_t shard_index(boost::asio::io_service &io_service) const {
+        for (std::size_t i = 0; i < shards_.size(); ++i) {
+            if (&shards_[i]->io_service == &io_service)
+                return i;
+        }
+        throw std::invalid_argument("ws::registry: unknown io_service");
+    }
+
+    /* One drain in flight per shard, however many producers */
+    void schedule(shard &s) {
+        if (!s.scheduled.exchange(true))
+            boost::asio::post(s.io_service, [this, &s]() { drain(s); });
+    }
+
+    void drain(shard &s) {
+        s.scheduled.store(false);
+
+        entry e;
+        for (std::size_t i = 0; i < max_batch_; ++i) {
+            if (!s.queue.pop(e))
+                return;
+
+            shard *owner;
+            std::uint32_t slot;
+            if (locate(e.id, owner, slot)) {
+                if (auto session = owner->slots[slot].session.lock())
+                    session->send(std::move(e.frame));
+            }
+        }
+
+        /* Batch is full, let other handlers run before the rest */
+        schedule(s);
+    }
+};
+
+} /* namespace ws */
+
+#endif /* WS_REGISTRY_HPP */
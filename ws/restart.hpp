@@ -0,0 +1,258 @@
+#ifndef WS_RESTART_HPP
+#define WS_RESTART_HPP
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/asio.hpp>
+
+namespace ws {
+
+/* Hot restart support.
+ *
+ * The running process owns a handoff_server bound to a Unix socket path. A
+ * newly started process calls acquire_listener() on the same path, receives
+ * a duplicate of the listening socket (SCM_RIGHTS) and starts accepting on
+ * it straight away; the kernel keeps queueing connections throughout so no
+ * connect is refused. The old process is then told to stop accepting and can
+ * drain its sessions with a drainer. */
+
+namespace detail {
+
+inline bool send_fd(int channel, int fd) {
+    char byte = 0;
+    iovec iov;
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+
+    char control[CMSG_SPACE(sizeof (int))];
+    std::memset(control, 0, sizeof (control));
+
+    msghdr msg;
+    std::memset(&msg, 0, sizeof (msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof (control);
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof (int));
+    std::memcpy(CMSG_DATA(cmsg), &fd, sizeof (int));
+
+    return ::sendmsg(channel, &msg, 0) == 1;
+}
+
+inline int receive_fd(int channel) {
+    char byte;
+    iovec iov;
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+
+    char control[CMSG_SPACE(sizeof (int))];
+
+    msghdr msg;
+    std::memset(&msg, 0, sizeof (msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof (control);
+
+    if (::recvmsg(channel, &msg, 0) != 1)
+        return -1;
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS)
+    {
+        return -1;
+    }
+
+    int fd;
+    std::memcpy(&fd, CMSG_DATA(cmsg), sizeof (int));
+    return fd;
+}
+
+/* Whether the process at the other end of a Unix socket runs as our user */
+inline bool same_user(int channel) {
+#ifdef SO_PEERCRED
+    ucred credentials;
+    socklen_t length = sizeof (credentials);
+    if (::getsockopt(channel, SOL_SOCKET, SO_PEERCRED, &credentials,
+        &length) != 0)
+    {
+        return false;
+    }
+    return credentials.uid == ::geteuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    return ::getpeereid(channel, &uid, &gid) == 0 && uid == ::geteuid();
+#endif /* SO_PEERCRED */
+}
+
+} /* namespace detail */
+
+/* Ask the process listening on path for its listening socket. Returns the
+ * received descriptor, or -1 if there is no previous process to take over
+ * from (in which case the caller binds as usual). */
+inline int acquire_listener(const std::string &path) {
+    using boost::asio::local::stream_protocol;
+
+    boost::asio::io_service io_service;
+    stream_protocol::socket channel(io_service);
+    boost::system::error_code ec;
+    channel.connect(stream_protocol::endpoint(path), ec);
+    if (ec || !detail::same_user(channel.native_handle()))
+        return -1;
+
+    return detail::receive_fd(channel.native_handle());
+}
+
+/* Serves the listening socket to the next process. on_handoff is called after
+ * the descriptor has been sent; the old process should stop accepting and
+ * start draining at that point. Only processes running as the same user are
+ * answered, and the path is only accessible to that user. */
+class handoff_server {
+public:
+    handoff_server(boost::asio::io_service &io_service,
+        const std::string &path, int listener_fd,
+        std::function<void()> on_handoff) :
+        path_(path), listener_fd_(listener_fd), on_handoff_(on_handoff),
+        acceptor_(io_service), channel_(io_service)
+    {
+        using boost::asio::local::stream_protocol;
+
+        /* A stale path from a previous generation would make bind fail */
+        ::unlink(path_.c_str());
+        acceptor_.open(stream_protocol());
+        acceptor_.bind(stream_protocol::endpoint(path_));
+        if (::chmod(path_.c_str(), S_IRUSR | S_IWUSR) != 0) {
+            throw boost::system::system_error(errno,
+                boost::system::system_category(), "chmod");
+        }
+        acceptor_.listen();
+        accept();
+    }
+
+    ~handoff_server() {
+        close();
+    }
+
+    /* Stop serving, e.g. once the descriptor has been handed over */
+    void close() {
+        boost::system::error_code ignored;
+        if (acceptor_.is_open()) {
+            acceptor_.close(ignored);
+            ::unlink(path_.c_str());
+        }
+    }
+
+private:
+    std::string path_;
+    int listener_fd_;
+    std::function<void()> on_handoff_;
+    boost::asio::local::stream_protocol::acceptor acceptor_;
+    boost::asio::local::stream_protocol::socket channel_;
+
+    void accept() {
+        acceptor_.async_accept(channel_,
+            [this](const boost::system::error_code &ec)
+        {
+            if (ec)
+                return;
+
+            bool sent = detail::same_user(channel_.native_handle()) &&
+                detail::send_fd(channel_.native_handle(), listener_fd_);
+            boost::system::error_code ignored;
+            channel_.close(ignored);
+
+            if (sent) {
+                /* The path now belongs to the new process */
+                acceptor_.close(ignored);
+                if (on_handoff_)
+                    on_handoff_();
+            } else {
+                accept();
+            }
+        });
+    }
+};
+
+/* Closes sessions at a bounded rate so that a restart doesn't turn into a
+ * reconnect storm against the new process. Session must provide
+ * shutdown(deadline), as ws::session does. Rates that aren't a multiple of
+ * the tick rate carry the remainder over, so e.g. 10 per second closes one
+ * session every tenth tick. */
+template <typename Session>
+class drainer {
+public:
+    drainer(boost::asio::io_service &io_service, std::size_t per_second,
+        std::chrono::steady_clock::duration close_deadline) :
+        timer_(io_service), per_second_(per_second ? per_second : 1),
+        credit_(0), close_deadline_(close_deadline) { }
+
+    /* Close every session still alive in sessions, calling done once the
+     * last close has been started */
+    void drain(std::vector<std::weak_ptr<Session>> sessions,
+        std::function<void()> done)
+    {
+        sessions_ = std::move(sessions);
+        next_ = 0;
+        credit_ = 0;
+        done_ = done;
+        tick();
+    }
+
+    void cancel() {
+        timer_.cancel();
+    }
+
+private:
+    enum { ticks_per_second = 100 };
+
+    boost::asio::steady_timer timer_;
+    std::size_t per_second_;
+    /* Closes owed, in units of 1/ticks_per_second of a close */
+    std::size_t credit_;
+    std::chrono::steady_clock::duration close_deadline_;
+    std::vector<std::weak_ptr<Session>> sessions_;
+    std::size_t next_;
+    std::function<void()> done_;
+
+    void tick() {
+        credit_ += per_second_;
+        while (next_ < sessions_.size() && credit_ >= ticks_per_second) {
+            if (auto s = sessions_[next_++].lock()) {
+                s->shutdown(close_deadline_);
+                credit_ -= ticks_per_second;
+            }
+        }
+
+        if (next_ == sessions_.size()) {
+            sessions_.clear();
+            if (done_)
+                done_();
+            return;
+        }
+
+        timer_.expires_after(std::chrono::milliseconds(
+            1000 / ticks_per_second));
+        timer_.async_wait([this](const boost::system::error_code &ec) {
+            if (!ec)
+                tick();
+        });
+    }
+};
+
+} /* namespace ws */
+
+#endif /* WS_RESTART_HPP */
@@ -0,0 +1,85 @@
+#ifndef WS_TLS_HPP
+#define WS_TLS_HPP
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/asio/ssl.hpp>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+#include "session.hpp"
+
+namespace ws {
+
+template <typename T>
+struct stream_traits<boost::asio::ssl::stream<T>> {
+    /* Every buffer of a gathered write becomes at least one TLS record, so
+     * queued frames are written from a single buffer instead */
+    static const bool coalesce_writes = true;
+    /* Decrypted data can be pending inside the TLS engine while the socket
+     * itself is not readable */
+    static const bool readiness_reads = false;
+    /* File bodies have to be encrypted in user space */
+    static const bool sendfile = false;
+};
+
+namespace tls {
+
+/* Length of the key material accepted by SSL_CTX_set_tlsext_ticket_keys: a
+ * 16 byte key name, a 32 byte HMAC secret and a 32 byte AES key */
+const std::size_t ticket_keys_length = 80;
+
+struct server_options {
+    server_options() :
+        session_id_context("ws"), session_cache_size(20480),
+        session_timeout(300) { }
+
+    /* Identifies sessions that may be resumed with this context */
+    std::string session_id_context;
+    /* Maximum number of sessions held in the server-side cache */
+    long session_cache_size;
+    /* Seconds a cached session or ticket may be resumed for */
+    long session_timeout;
+    /* Ticket encryption keys, ticket_keys_length bytes. Processes that should
+     * accept each other's tickets must share the same keys; left empty, keys
+     * are generated and only this process can resume its tickets. */
+    std::vector<unsigned char> ticket_keys;
+};
+
+inline std::vector<unsigned char> generate_ticket_keys() {
+    std::vector<unsigned char> keys(ticket_keys_length);
+    if (RAND_bytes(keys.data(), static_cast<int>(keys.size())) != 1)
+        throw std::runtime_error("ws::tls: unable to generate ticket keys");
+    return keys;
+}
+
+/* Enable session resumption (server-side cache and tickets) on a server
+ * context. Call before any handshake uses it. */
+inline void configure_server(boost::asio::ssl::context &context,
+    const server_options &options = server_options())
+{
+    SSL_CTX *ctx = context.native_handle();
+
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx, options.session_cache_size);
+    SSL_CTX_set_timeout(ctx, options.session_timeout);
+    SSL_CTX_set_session_id_context(ctx,
+        reinterpret_cast<const unsigned char *>(
+            options.session_id_context.data()),
+        static_cast<unsigned int>(options.session_id_context.size()));
+
+    std::vector<unsigned char> keys = options.ticket_keys.empty() ?
+        generate_ticket_keys() : options.ticket_keys;
+    if (keys.size() != ticket_keys_length ||
+        SSL_CTX_set_tlsext_ticket_keys(ctx, keys.data(),
+            static_cast<long>(keys.size())) != 1)
+    {
+        throw std::invalid_argument("ws::tls: invalid ticket keys");
+    }
+}
+
+} /* namespace tls */
+
+} /* namespace ws */
+
+#endif /* WS_TLS_HPP */
@@ -0,0 +1,959 @@
+#ifndef WS_URING_HPP
+#define WS_URING_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <boost/asio.hpp>
+#include "session.hpp"
+
+namespace ws {
+
+namespace detail {
+
+/* Ring indices shared with the kernel */
+inline unsigned load_acquire(const unsigned *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+inline void store_release(unsigned *p, unsigned value) {
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+} /* namespace detail */
+
+/* An io_uring instance whose completions are handled on the thread running
+ * io_service, for the sockets of uring_streams (Linux 6.0 or later).
+ *
+ * Receives are multishot into a ring of buffers shared by every stream, so a
+ * connection holds no receive buffer until data arrives for it.
+ * Submissions queued while handlers run, such as the replies written by
+ * every session a batch of completions woke, go to the kernel in one
+ * io_uring_enter() once the io_service gets to it. The ring's completions
+ * are signalled through an eventfd the io_service waits on, so sessions
+ * over uring_streams and over Asio sockets share one io thread.
+ *
+ * buffers must be a power of 2 no greater than 32768. The uring must be
+ * used from the io_service's thread, be destroyed before it, and outlive
+ * its run(). Streams may outlive it, their operations are then dropped. */
+class uring {
+public:
+    explicit uring(boost::asio::io_service &io_service,
+        unsigned entries = default_entries,
+        unsigned buffers = default_buffers,
+        std::size_t buffer_size = default_buffer_size) :
+        io_service_(io_service), eventfd_(io_service),
+        buffer_count_(buffers), buffer_size_(buffer_size),
+        sq_tail_(0), sq_submitted_(0), buffer_tail_(0),
+        submit_scheduled_(false), rearm_scheduled_(false),
+        stopped_(std::make_shared<bool>(false)), pending_(nullptr),
+        enters_(0)
+    {
+        if (!buffers || buffers > 32768 || (buffers & (buffers - 1)) ||
+            !buffer_size)
+        {
+            throw std::invalid_argument("ws::uring: bad buffer count");
+        }
+
+        io_uring_params params;
+        std::memset(&params, 0, sizeof (params));
+        /* Multishot receives post a completion per read */
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = 4 * entries;
+        fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries,
+            &params));
+        if (fd_ < 0)
+            throw_errno("io_uring_setup");
+
+        try {
+            map_rings(params);
+            setup_buffers();
+
+            int efd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (efd < 0)
+                throw_errno("eventfd");
+            eventfd_.assign(efd);
+            if (enter_register(IORING_REGISTER_EVENTFD, &efd, 1) < 0)
+                throw_errno("io_uring_register");
+        } catch (...) {
+            unmap();
+            throw;
+        }
+
+        wait();
+    }
+
+    uring(const uring &) = delete;
+    uring &operator=(const uring &) = delete;
+
+    ~uring() {
+        *stopped_ = true;
+
+        /* Nothing may still write into the buffers once they are unmapped,
+         * submissions not yet made are dropped below */
+        io_uring_sync_cancel_reg reg;
+        std::memset(&reg, 0, sizeof (reg));
+        reg.flags = IORING_ASYNC_CANCEL_ANY;
+        reg.timeout.tv_sec = -1;
+        reg.timeout.tv_nsec = -1;
+        enter_register(IORING_REGISTER_SYNC_CANCEL, &reg, 1);
+
+        /* Operations that never completed are dropped without running their
+         * handlers, as the io_service does with its own */
+        for (unsigned head = *cq_head_; head != detail::load_acquire(
+            cq_tail_); ++head)
+        {
+            const io_uring_cqe &cqe = cqes_[head & cq_mask_];
+            if (cqe.user_data && !(cqe.flags & IORING_CQE_F_MORE))
+                delete reinterpret_cast<operation *>(cqe.user_data);
+        }
+        for (unsigned i = sq_submitted_; i != sq_tail_; ++i) {
+            const io_uring_sqe &sqe = sqes_[i & sq_mask_];
+            if (sqe.user_data)
+                delete reinterpret_cast<operation *>(sqe.user_data);
+        }
+        for (auto &sqe : backlog_) {
+            if (sqe.user_data)
+                delete reinterpret_cast<operation *>(sqe.user_data);
+        }
+        while (pending_)
+            unpark(pending_);
+
+        boost::system::error_code ignored;
+        eventfd_.close(ignored);
+        unmap();
+    }
+
+    boost::asio::io_service &get_io_service() {
+        return io_service_;
+    }
+
+    /* io_uring_enter() calls so far */
+    std::size_t enters() const {
+        return enters_;
+    }
+
+private:
+    friend class uring_stream;
+
+    enum {
+        default_entries = 4096,
+        default_buffers = 4096,
+        default_buffer_size = 4096,
+        buffer_group = 0
+    };
+
+    /* An operation in flight, whose address is the user_data of its
+     * submission */
+    struct operation {
+        virtual ~operation() { }
+
+        /* Whether the operation is done and can be deleted, false while a
+         * multishot operation has more completions to come */
+        virtual bool complete(int res, unsigned flags) = 0;
+    };
+
+    /* A read or wait parked until its stream has data. The uring holds
+     * them, so destroying it destroys their handlers as the io_service
+     * does with the operations it holds. */
+    struct pending_operation {
+        pending_operation() : prev(nullptr), next(nullptr) { }
+        virtual ~pending_operation() { }
+        virtual void complete() = 0;
+
+        pending_operation *prev;
+        pending_operation *next;
+    };
+
+    boost::asio::io_service &io_service_;
+    boost::asio::posix::stream_descriptor eventfd_;
+    int fd_;
+    unsigned buffer_count_;
+    std::size_t buffer_size_;
+
+    /* Rings mapped from the kernel */
+    void *sq_ring_;
+    std::size_t sq_ring_size_;
+    void *cq_ring_;
+    std::size_t cq_ring_size_;
+    io_uring_sqe *sqes_;
+    std::size_t sqes_size_;
+    unsigned *sq_head_;
+    unsigned *sq_tail_shared_;
+    unsigned *sq_flags_;
+    unsigned sq_entries_;
+    unsigned sq_mask_;
+    unsigned *cq_head_;
+    unsigned *cq_tail_;
+    io_uring_cqe *cqes_;
+    unsigned cq_mask_;
+    unsigned sq_tail_;
+    unsigned sq_submitted_;
+    /* Submissions made while the submission queue was full */
+    std::deque<io_uring_sqe> backlog_;
+
+    /* Provided buffers: the ring handing them to the kernel, and their
+     * memory */
+    io_uring_buf *buffer_ring_;
+    unsigned short *buffer_ring_tail_;
+    unsigned buffer_tail_;
+    unsigned char *buffers_;
+
+    bool submit_scheduled_;
+    /* Receives stopped for want of buffers, resumed once some come back */
+    std::vector<std::function<void()>> starved_;
+    bool rearm_scheduled_;
+    /* Set once the uring is going, streams that outlive it check it */
+    std::shared_ptr<bool> stopped_;
+    pending_operation *pending_;
+    std::size_t enters_;
+
+    static void throw_errno(const char *what) {
+        throw boost::system::system_error(errno,
+            boost::system::system_category(), what);
+    }
+
+    int enter_register(unsigned opcode, void *arg, unsigned count) {
+        return static_cast<int>(::syscall(__NR_io_uring_register, fd_,
+            opcode, arg, count));
+    }
+
+    void map_rings(const io_uring_params &params) {
+        sq_ring_ = cq_ring_ = sqes_ = nullptr;
+        buffer_ring_ = nullptr;
+        buffers_ = nullptr;
+
+        sq_ring_size_ = params.sq_off.array +
+            params.sq_entries * sizeof (unsigned);
+        cq_ring_size_ = params.cq_off.cqes +
+            params.cq_entries * sizeof (io_uring_cqe);
+        sq_ring_ = map(sq_ring_size_, IORING_OFF_SQ_RING);
+        cq_ring_ = map(cq_ring_size_, IORING_OFF_CQ_RING);
+        sqes_size_ = params.sq_entries * sizeof (io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe *>(map(sqes_size_,
+            IORING_OFF_SQES));
+
+        char *sq = static_cast<char *>(sq_ring_);
+        sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        sq_tail_shared_ = reinterpret_cast<unsigned *>(sq +
+            params.sq_off.tail);
+        sq_flags_ = reinterpret_cast<unsigned *>(sq + params.sq_off.flags);
+        sq_entries_ = params.sq_entries;
+        sq_mask_ = *reinterpret_cast<unsigned *>(sq +
+            params.sq_off.ring_mask);
+        unsigned *array = reinterpret_cast<unsigned *>(sq +
+            params.sq_off.array);
+        for (unsigned i = 0; i < sq_entries_; ++i)
+            array[i] = i;
+        sq_tail_ = sq_submitted_ = *sq_tail_shared_;
+
+        char *cq = static_cast<char *>(cq_ring_);
+        cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned *>(cq +
+            params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    }
+
+    void *map(std::size_t size, off_t offset) {
+        void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd_, offset);
+        if (p == MAP_FAILED)
+            throw_errno("mmap");
+        return p;
+    }
+
+    void setup_buffers() {
+        void *ring = ::mmap(nullptr, buffer_count_ * sizeof (io_uring_buf),
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED)
+            throw_errno("mmap");
+        buffer_ring_ = static_cast<io_uring_buf *>(ring);
+        /* The tail overlays the first entry's reserved field */
+        buffer_ring_tail_ = &buffer_ring_[0].resv;
+
+        void *memory = ::mmap(nullptr, buffer_count_ * buffer_size_,
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+            throw_errno("mmap");
+        buffers_ = static_cast<unsigned char *>(memory);
+
+        io_uring_buf_reg reg;
+        std::memset(&reg, 0, sizeof (reg));
+        reg.ring_addr = reinterpret_cast<std::uint64_t>(buffer_ring_);
+        reg.ring_entries = buffer_count_;
+        reg.bgid = buffer_group;
+        if (enter_register(IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+            throw_errno("io_uring_register");
+
+        for (unsigned i = 0; i < buffer_count_; ++i)
+            recycle(static_cast<unsigned short>(i));
+    }
+
+    void unmap() {
+        if (sqes_)
+            ::munmap(sqes_, sqes_size_);
+        if (cq_ring_)
+            ::munmap(cq_ring_, cq_ring_size_);
+        if (sq_ring_)
+            ::munmap(sq_ring_, sq_ring_size_);
+        ::close(fd_);
+        if (buffers_)
+            ::munmap(buffers_, buffer_count_ * buffer_size_);
+        if (buffer_ring_)
+            ::munmap(buffer_ring_, buffer_count_ * sizeof (io_uring_buf));
+    }
+
+    /* A zeroed submission to fill in, sent with the next submit() */
+    io_uring_sqe &sqe() {
+        schedule_submit();
+        if (backlog_.empty() &&
+            sq_tail_ - detail::load_acquire(sq_head_) < sq_entries_)
+        {
+            io_uring_sqe &s = sqes_[sq_tail_++ & sq_mask_];
+            std::memset(&s, 0, sizeof (s));
+            return s;
+        }
+        backlog_.emplace_back();
+        std::memset(&backlog_.back(), 0, sizeof (io_uring_sqe));
+        return backlog_.back();
+    }
+
+    void park(pending_operation *op) {
+        op->next = pending_;
+        if (pending_)
+            pending_->prev = op;
+        pending_ = op;
+    }
+
+    /* Hands a parked operation back to the caller */
+    std::unique_ptr<pending_operation> unpark(pending_operation *op) {
+        if (op->prev)
+            op->prev->next = op->next;
+        else
+            pending_ = op->next;
+        if (op->next)
+            op->next->prev = op->prev;
+        op->prev = op->next = nullptr;
+        return std::unique_ptr<pending_operation>(op);
+    }
+
+    unsigned char *buffer(unsigned short id) {
+        return buffers_ + id * buffer_size_;
+    }
+
+    /* Hand a buffer back to the kernel */
+    void recycle(unsigned short id) {
+        if (*stopped_)
+            return;
+
+        io_uring_buf &b = buffer_ring_[buffer_tail_ & (buffer_count_ - 1)];
+        b.addr = reinterpret_cast<std::uint64_t>(buffer(id));
+        b.len = static_cast<unsigned>(buffer_size_);
+        b.bid = id;
+        ++buffer_tail_;
+        __atomic_store_n(buffer_ring_tail_,
+            static_cast<unsigned short>(buffer_tail_), __ATOMIC_RELEASE);
+
+        if (!starved_.empty())
+            schedule_rearm();
+    }
+
+    /* A receive found no buffer. Buffers may have come back since the
+     * kernel looked, so it is retried after the handlers already queued,
+     * which usually return more, and again whenever one comes back. */
+    void starve(std::function<void()> rearm) {
+        starved_.push_back(std::move(rearm));
+        schedule_rearm();
+    }
+
+    void schedule_rearm() {
+        if (rearm_scheduled_ || *stopped_)
+            return;
+        rearm_scheduled_ = true;
+        boost::asio::post(io_service_, [this]() {
+            rearm_scheduled_ = false;
+            std::vector<std::function<void()>> starved;
+            starved.swap(starved_);
+            for (auto &rearm : starved)
+                rearm();
+        });
+    }
+
+    /* One submission per turn of the io_service, however many operations
+     * were started meanwhile */
+    void schedule_submit() {
+        if (submit_scheduled_ || *stopped_)
+            return;
+        submit_scheduled_ = true;
+        boost::asio::post(io_service_, [this]() {
+            submit_scheduled_ = false;
+            submit();
+        });
+    }
+
+    void submit() {
+        while (!backlog_.empty() &&
+            sq_tail_ - detail::load_acquire(sq_head_) < sq_entries_)
+        {
+            sqes_[sq_tail_++ & sq_mask_] = backlog_.front();
+            backlog_.pop_front();
+        }
+
+        unsigned pending = sq_tail_ - sq_submitted_;
+        if (!pending)
+            return;
+
+        detail::store_release(sq_tail_shared_, sq_tail_);
+        int n = static_cast<int>(::syscall(__NR_io_uring_enter, fd_,
+            pending, 0, 0, nullptr, 0));
+        ++enters_;
+        if (n > 0)
+            sq_submitted_ += n;
+        else if (n < 0 && errno != EAGAIN && errno != EBUSY &&
+            errno != EINTR)
+        {
+            throw_errno("io_uring_enter");
+        }
+
+        /* The kernel is short of room or completions need reaping first,
+         * try again on the next turn */
+        if (sq_submitted_ != sq_tail_ || !backlog_.empty())
+            schedule_submit();
+    }
+
+    void wait() {
+        eventfd_.async_wait(boost::asio::posix::descriptor_base::wait_read,
+            [this](const boost::system::error_code &ec)
+        {
+            if (ec)
+                return;
+
+            std::uint64_t count;
+            if (::read(eventfd_.native_handle(), &count, sizeof (count)) < 0 &&
+                errno != EAGAIN)
+            {
+                throw_errno("read");
+            }
+            reap();
+            wait();
+        });
+    }
+
+    void reap() {
+        unsigned head = *cq_head_;
+        for (;;) {
+            if (head == detail::load_acquire(cq_tail_)) {
+                /* Completions the ring had no room for wait in the kernel
+                 * until asked for */
+                if (!(detail::load_acquire(sq_flags_) & IORING_SQ_CQ_OVERFLOW))
+                    break;
+                ::syscall(__NR_io_uring_enter, fd_, 0, 0,
+                    IORING_ENTER_GETEVENTS, nullptr, 0);
+                ++enters_;
+                continue;
+            }
+
+            const io_uring_cqe &cqe = cqes_[head & cq_mask_];
+            std::uint64_t user_data = cqe.user_data;
+            int res = cqe.res;
+            unsigned flags = cqe.flags;
+            detail::store_release(cq_head_, ++head);
+
+            if (user_data) {
+                operation *op = reinterpret_cast<operation *>(user_data);
+                if (op->complete(res, flags))
+                    delete op;
+            }
+        }
+    }
+};
+
+/* A connected TCP socket whose reads and writes go through a uring. Meets
+ * what a session needs of its stream, see ws::uring for how it differs
+ * from tcp::socket. A peer's bytes are taken off the socket as they arrive
+ * and wait in the uring's buffers until read; past max_queued_buffers of
+ * them the stream stops receiving until some are read. */
+class uring_stream {
+public:
+    typedef boost::asio::io_service::executor_type executor_type;
+    typedef uring_stream lowest_layer_type;
+
+    /* Takes over socket, which must be connected */
+    uring_stream(uring &ring, tcp::socket socket) : ring_(ring) {
+        endpoint_ = socket.remote_endpoint(endpoint_error_);
+        int fd = socket.release();
+        /* io_uring fails operations on non-blocking sockets with EAGAIN
+         * rather than waiting */
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+        state_ = std::make_shared<state>(ring, fd);
+        state_->receive(state_);
+    }
+
+    uring_stream(const uring_stream &) = delete;
+    uring_stream &operator=(const uring_stream &) = delete;
+
+    ~uring_stream() {
+        boost::system::error_code ignored;
+        close(ignored);
+    }
+
+    executor_type get_executor() {
+        return ring_.get_io_service().get_executor();
+    }
+
+    lowest_layer_type &lowest_layer() {
+        return *this;
+    }
+
+    bool is_open() const {
+        return !state_->closed;
+    }
+
+    int native_handle() const {
+        return state_->fd;
+    }
+
+    tcp::endpoint remote_endpoint(boost::system::error_code &ec) const {
+        ec = endpoint_error_;
+        return endpoint_;
+    }
+
+    tcp::endpoint remote_endpoint() const {
+        if (endpoint_error_)
+            throw boost::system::system_error(endpoint_error_);
+        return endpoint_;
+    }
+
+    /* Pending operations are aborted. Shutting the socket down first makes
+     * the kernel finish what it still holds for it. */
+    void close(boost::system::error_code &ec) {
+        ec = boost::system::error_code();
+        state &s = *state_;
+        if (s.closed)
+            return;
+
+        s.closed = true;
+        ::shutdown(s.fd, SHUT_RDWR);
+        if (::close(s.fd) != 0)
+            ec = boost::system::error_code(errno,
+                boost::system::system_category());
+        if (*s.stopped) {
+            s.chunks.clear();
+            return;
+        }
+
+        for (auto &c : s.chunks)
+            ring_.recycle(c.id);
+        s.chunks.clear();
+        if (s.waiter) {
+            std::shared_ptr<uring::pending_operation> w(
+                ring_.unpark(s.waiter));
+            s.waiter = nullptr;
+            boost::asio::post(ring_.get_io_service(), shared_waiter{w});
+        }
+    }
+
+    void close() {
+        boost::system::error_code ec;
+        close(ec);
+        if (ec)
+            throw boost::system::system_error(ec);
+    }
+
+    template <typename MutableBufferSequence, typename ReadHandler>
+    void async_read_some(const MutableBufferSequence &buffers,
+        ReadHandler &&handler)
+    {
+        typedef typename std::decay<ReadHandler>::type handler_type;
+
+        state &s = *state_;
+        if (s.ready() || !boost::asio::buffer_size(buffers)) {
+            boost::system::error_code ec;
+            std::size_t n = s.take(state_, buffers, ec);
+            boost::asio::post(ring_.get_io_service(),
+                bound_handler<handler_type>(
+                std::forward<ReadHandler>(handler), ec, n));
+            return;
+        }
+
+        s.waiter = new read_waiter<MutableBufferSequence, handler_type>(
+            state_, buffers, std::forward<ReadHandler>(handler));
+        ring_.park(s.waiter);
+    }
+
+    template <typename ConstBufferSequence, typename WriteHandler>
+    void async_write_some(const ConstBufferSequence &buffers,
+        WriteHandler &&handler)
+    {
+        typedef typename std::decay<WriteHandler>::type handler_type;
+
+        if (state_->closed || !boost::asio::buffer_size(buffers)) {
+            boost::asio::post(ring_.get_io_service(),
+                bound_handler<handler_type>(std::forward<WriteHandler>(
+                handler), state_->closed ? boost::asio::error::bad_descriptor :
+                boost::system::error_code(), 0));
+            return;
+        }
+
+        auto op = new send_operation<handler_type>(state_,
+            std::forward<WriteHandler>(handler));
+        std::size_t count = 0;
+        for (auto i = boost::asio::buffer_sequence_begin(buffers);
+            i != boost::asio::buffer_sequence_end(buffers) &&
+            count < max_iov; ++i)
+        {
+            boost::asio::const_buffer b(*i);
+            if (b.size()) {
+                op->iov[count].iov_base = const_cast<void *>(b.data());
+                op->iov[count].iov_len = b.size();
+                ++count;
+            }
+        }
+        op->msg.msg_iov = op->iov;
+        op->msg.msg_iovlen = count;
+
+        io_uring_sqe &sqe = ring_.sqe();
+        sqe.opcode = IORING_OP_SENDMSG;
+        sqe.fd = state_->fd;
+        sqe.addr = reinterpret_cast<std::uint64_t>(&op->msg);
+        sqe.len = 1;
+        sqe.msg_flags = MSG_NOSIGNAL;
+        sqe.user_data = reinterpret_cast<std::uint64_t>(
+            static_cast<uring::operation *>(op));
+    }
+
+    /* Readiness, as for a socket: reading completes once there is data or
+     * end of file, writing straight away */
+    template <typename WaitHandler>
+    void async_wait(boost::asio::socket_base::wait_type type,
+        WaitHandler &&handler)
+    {
+        typedef typename std::decay<WaitHandler>::type handler_type;
+
+        state &s = *state_;
+        if (type != boost::asio::socket_base::wait_read || s.ready()) {
+            boost::asio::post(ring_.get_io_service(),
+                bound_wait_handler<handler_type>{
+                std::forward<WaitHandler>(handler), s.closed ?
+                boost::asio::error::operation_aborted :
+                boost::system::error_code()});
+            return;
+        }
+
+        s.waiter = new wait_waiter<handler_type>(state_,
+            std::forward<WaitHandler>(handler));
+        ring_.park(s.waiter);
+    }
+
+private:
+    enum {
+        max_queued_buffers = 4,
+        /* As Asio caps a gathered write */
+        max_iov = 64
+    };
+
+    /* Part of a provided buffer the kernel filled */
+    struct chunk {
+        unsigned short id;
+        std::size_t offset;
+        std::size_t length;
+    };
+
+    struct state;
+
+    /* The multishot receive, alive until its last completion */
+    struct receive_operation : uring::operation {
+        explicit receive_operation(const std::shared_ptr<state> &s) :
+            s_(s) { }
+
+        bool complete(int res, unsigned flags) override {
+            state &s = *s_;
+            uring &ring = s.ring;
+            if (flags & IORING_CQE_F_BUFFER) {
+                unsigned short id = static_cast<unsigned short>(
+                    flags >> IORING_CQE_BUFFER_SHIFT);
+                if (res > 0 && !s.closed)
+                    s.chunks.push_back(chunk{id, 0,
+                        static_cast<std::size_t>(res)});
+                else
+                    ring.recycle(id);
+            }
+
+            bool starved = false;
+            if (res == 0)
+                s.eof = true;
+            else if (res == -ENOBUFS)
+                starved = true;
+            else if (res < 0 && res != -ECANCELED)
+                s.error = boost::system::error_code(-res,
+                    boost::system::system_category());
+
+            bool more = flags & IORING_CQE_F_MORE;
+            if (!more) {
+                s.receiving = nullptr;
+                s.cancelling = false;
+            }
+
+            std::shared_ptr<state> keep(s_);
+            s.wake();
+            if (!more) {
+                if (starved) {
+                    std::weak_ptr<state> weak(keep);
+                    ring.starve([weak]() {
+                        if (auto s = weak.lock())
+                            s->receive(s);
+                    });
+                } else {
+                    s.receive(keep);
+                }
+            } else if (s.chunks.size() >= max_queued_buffers) {
+                s.pause();
+            }
+            return !more;
+        }
+
+        std::shared_ptr<state> s_;
+    };
+
+    template <typename Handler>
+    struct send_operation : uring::operation {
+        template <typename H>
+        send_operation(const std::shared_ptr<state> &s, H &&h) :
+            s_(s), handler(std::forward<H>(h))
+        {
+            std::memset(&msg, 0, sizeof (msg));
+        }
+
+        bool complete(int res, unsigned) override {
+            boost::system::error_code ec;
+            if (s_->closed || res == -ECANCELED)
+                ec = boost::asio::error::operation_aborted;
+            else if (res < 0)
+                ec = boost::system::error_code(-res,
+                    boost::system::system_category());
+            handler(ec, res < 0 ? 0 : static_cast<std::size_t>(res));
+            return true;
+        }
+
+        std::shared_ptr<state> s_;
+        Handler handler;
+        msghdr msg;
+        iovec iov[max_iov];
+    };
+
+    /* Everything operations in flight need, which may outlive the stream */
+    struct state {
+        state(uring &r, int descriptor) :
+            ring(r), stopped(r.stopped_), fd(descriptor), receiving(nullptr),
+            cancelling(false), eof(false), closed(false), waiter(nullptr) { }
+
+        uring &ring;
+        std::shared_ptr<const bool> stopped;
+        int fd;
+        std::deque<chunk> chunks;
+        receive_operation *receiving;
+        bool cancelling;
+        bool eof;
+        bool closed;
+        boost::system::error_code error;
+        /* The pending read or wait, parked in the uring */
+        uring::pending_operation *waiter;
+
+        bool ready() const {
+            return !chunks.empty() || eof || error || closed;
+        }
+
+        /* Arm the multishot receive unless it is running or mustn't */
+        void receive(const std::shared_ptr<state> &self) {
+            if (receiving || eof || error || closed ||
+                chunks.size() >= max_queued_buffers)
+            {
+                return;
+            }
+
+            receiving = new receive_operation(self);
+            io_uring_sqe &sqe = ring.sqe();
+            sqe.opcode = IORING_OP_RECV;
+            sqe.fd = fd;
+            sqe.flags = IOSQE_BUFFER_SELECT;
+            sqe.buf_group = uring::buffer_group;
+            sqe.ioprio = IORING_RECV_MULTISHOT;
+            sqe.user_data = reinterpret_cast<std::uint64_t>(
+                static_cast<uring::operation *>(receiving));
+        }
+
+        /* Stop taking the peer's bytes off the socket until some are
+         * read, the socket's own buffer then pushes back on the peer */
+        void pause() {
+            if (!receiving || cancelling)
+                return;
+
+            cancelling = true;
+            io_uring_sqe &sqe = ring.sqe();
+            sqe.opcode = IORING_OP_ASYNC_CANCEL;
+            sqe.addr = reinterpret_cast<std::uint64_t>(
+                static_cast<uring::operation *>(receiving));
+        }
+
+        void wake() {
+            if (waiter && ready()) {
+                std::unique_ptr<uring::pending_operation> w(
+                    ring.unpark(waiter));
+                waiter = nullptr;
+                w->complete();
+            }
+        }
+
+        /* Copy what has been received into buffers */
+        template <typename MutableBufferSequence>
+        std::size_t take(const std::shared_ptr<state> &self,
+            const MutableBufferSequence &buffers,
+            boost::system::error_code &ec)
+        {
+            std::size_t n = 0;
+            for (auto i = boost::asio::buffer_sequence_begin(buffers);
+                i != boost::asio::buffer_sequence_end(buffers) &&
+                !chunks.empty(); ++i)
+            {
+                boost::asio::mutable_buffer b(*i);
+                while (b.size() && !chunks.empty()) {
+                    chunk &c = chunks.front();
+                    std::size_t length = std::min(b.size(),
+                        c.length - c.offset);
+                    std::memcpy(b.data(), ring.buffer(c.id) + c.offset,
+                        length);
+                    b += length;
+                    c.offset += length;
+                    n += length;
+                    if (c.offset == c.length) {
+                        ring.recycle(c.id);
+                        chunks.pop_front();
+                    }
+                }
+            }
+
+            if (closed)
+                ec = boost::asio::error::operation_aborted;
+            else if (!n && error)
+                ec = error;
+            else if (!n && eof && boost::asio::buffer_size(buffers))
+                ec = boost::asio::error::eof;
+
+            receive(self);
+            return n;
+        }
+    };
+
+    struct parked_operation : uring::pending_operation {
+        explicit parked_operation(const std::shared_ptr<state> &s) : s_(s) { }
+
+        /* Destroyed unrun along with the uring */
+        ~parked_operation() {
+            if (s_->waiter == this)
+                s_->waiter = nullptr;
+        }
+
+        std::shared_ptr<state> s_;
+    };
+
+    template <typename MutableBufferSequence, typename Handler>
+    struct read_waiter : parked_operation {
+        template <typename H>
+        read_waiter(const std::shared_ptr<state> &s,
+            const MutableBufferSequence &b, H &&h) :
+            parked_operation(s), buffers(b), handler(std::forward<H>(h)) { }
+
+        void complete() override {
+            boost::system::error_code ec;
+            std::size_t n = this->s_->take(this->s_, buffers, ec);
+            handler(ec, n);
+        }
+
+        MutableBufferSequence buffers;
+        Handler handler;
+    };
+
+    template <typename Handler>
+    struct wait_waiter : parked_operation {
+        template <typename H>
+        wait_waiter(const std::shared_ptr<state> &s, H &&h) :
+            parked_operation(s), handler(std::forward<H>(h)) { }
+
+        void complete() override {
+            handler(this->s_->closed ? boost::asio::error::operation_aborted :
+                boost::system::error_code());
+        }
+
+        Handler handler;
+    };
+
+    /* Completes a waiter aborted by close() from the io_service */
+    struct shared_waiter {
+        void operator()() {
+            w->complete();
+        }
+
+        std::shared_ptr<uring::pending_operation> w;
+    };
+
+    /* Handler with its result, posted without further allocation */
+    template <typename Handler>
+    struct bound_handler {
+        template <typename H>
+        bound_handler(H &&h, const boost::system::error_code &e,
+            std::size_t count) :
+            handler(std::forward<H>(h)), ec(e), n(count) { }
+
+        void operator()() {
+            handler(ec, n);
+        }
+
+        Handler handler;
+        boost::system::error_code ec;
+        std::size_t n;
+    };
+
+    template <typename Handler>
+    struct bound_wait_handler {
+        void operator()() {
+            handler(ec);
+        }
+
+        Handler handler;
+        boost::system::error_code ec;
+    };
+
+    uring &ring_;
+    std::shared_ptr<state> state_;
+    tcp::endpoint endpoint_;
+    boost::system::error_code endpoint_error_;
+};
+
+template <>
+struct stream_traits<uring_stream> {
+    static const bool coalesce_writes = false;
+    static const bool readiness_reads = true;
+    /* The socket belongs to the uring, file bodies are written through it */
+    static const bool sendfile = false;
+};
+
+} /* namespace ws */
+
+#endif /* WS_URING_HPP */
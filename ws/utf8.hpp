@@ -0,0 +1,54 @@
+#ifndef WS_UTF8_HPP
+#define WS_UTF8_HPP
+
+#include <cstddef>
+
+namespace ws {
+
+/* Whether data is well-formed UTF-8 (no overlong encodings, surrogates or
+ * code points above U+10FFFF), as required of text message payloads */
+inline bool valid_utf8(const unsigned char *data, std::size_t length) {
+    std::size_t i = 0;
+    while (i < length) {
+        unsigned char c = data[i];
+        if (c < 0x80) {
+            ++i;
+            continue;
+        }
+
+        std::size_t n;
+        unsigned char lo = 0x80, hi = 0xbf;
+        if (c >= 0xc2 && c <= 0xdf) {
+            n = 1;
+        } else if (c >= 0xe0 && c <= 0xef) {
+            n = 2;
+            if (c == 0xe0)
+                lo = 0xa0;
+            else if (c == 0xed)
+                hi = 0x9f;
+        } else if (c >= 0xf0 && c <= 0xf4) {
+            n = 3;
+            if (c == 0xf0)
+                lo = 0x90;
+            else if (c == 0xf4)
+                hi = 0x8f;
+        } else {
+            return false;
+        }
+
+        if (length - i <= n)
+            return false;
+        /* Only the first continuation byte has a restricted range */
+        if (data[i + 1] < lo || data[i + 1] > hi)
+            return false;
+        for (std::size_t j = 2; j <= n; ++j)
+            if ((data[i + j] & 0xc0) != 0x80)
+                return false;
+        i += n + 1;
+    }
+    return true;
+}
+
+} /* namespace ws */
+
+#endif /* WS_UTF8_HPP */
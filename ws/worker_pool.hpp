@@ -0,0 +1,59 @@
+#ifndef WS_WORKER_POOL_HPP
+#define WS_WORKER_POOL_HPP
+
+#include <memory>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+
+namespace ws {
+
+/* Threads that run message handlers off the io threads. Sessions dispatch
+ * onto the pool through their own strand, so each session's messages are
+ * still handled one at a time and in order while different sessions run in
+ * parallel on whichever worker is free. */
+class worker_pool {
+public:
+    explicit worker_pool(std::size_t threads) :
+        work_(new boost::asio::io_service::work(io_service_))
+    {
+        for (std::size_t i = 0; i < threads; ++i) {
+            threads_.emplace_back([this]() {
+                in_worker() = true;
+                io_service_.run();
+            });
+        }
+    }
+
+    ~worker_pool() {
+        work_.reset();
+        for (auto &t : threads_)
+            t.join();
+    }
+
+    worker_pool(const worker_pool &) = delete;
+    worker_pool &operator=(const worker_pool &) = delete;
+
+    boost::asio::io_service &get_io_service() {
+        return io_service_;
+    }
+
+    /* Whether the calling thread is a worker of some pool */
+    static bool on_worker_thread() {
+        return in_worker();
+    }
+
+private:
+    boost::asio::io_service io_service_;
+    std::unique_ptr<boost::asio::io_service::work> work_;
+    std::vector<std::thread> threads_;
+
+    static bool &in_worker() {
+        static thread_local bool flag = false;
+        return flag;
+    }
+};
+
+} /* namespace ws */
+
+#endif /* WS_WORKER_POOL_HPP */